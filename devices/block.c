@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -19,6 +20,8 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long read_ns;         /* Total time spent reading. */
+    unsigned long long write_ns;        /* Total time spent writing. */
   };
 
 /* List of all block devices. */
@@ -120,9 +123,12 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start = timer_now_ns ();
+
   check_sector (block, sector);
   block->ops->read (block->aux, sector, buffer);
   block->read_cnt++;
+  block->read_ns += timer_now_ns () - start;
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +139,13 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start = timer_now_ns ();
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
   block->ops->write (block->aux, sector, buffer);
   block->write_cnt++;
+  block->write_ns += timer_now_ns () - start;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -174,6 +183,11 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->read_cnt > 0 || block->write_cnt > 0)
+            printf ("%s (%s): %llu us average read, %llu us average write\n",
+                    block->name, block_type_name (block->type),
+                    block->read_cnt ? block->read_ns / block->read_cnt / 1000 : 0,
+                    block->write_cnt ? block->write_ns / block->write_cnt / 1000 : 0);
         }
     }
 }
@@ -200,6 +214,8 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->read_ns = 0;
+  block->write_ns = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,34 +1,50 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
-static int next (int pos);
-static void wait (struct intq *q, struct thread **waiter);
-static void signal (struct intq *q, struct thread **waiter);
+/* The buffer is indexed by masking, which needs a power of 2. */
+#if INTQ_BUFSIZE & (INTQ_BUFSIZE - 1)
+#error INTQ_BUFSIZE must be a power of 2
+#endif
+
+static size_t pos (unsigned index);
+static void wait (struct intq *q, struct list *waiters);
+static void signal (struct intq *q, struct list *waiters);
 
 /* Initializes interrupt queue Q. */
 void
 intq_init (struct intq *q)
 {
-  lock_init (&q->lock);
-  q->not_full = q->not_empty = NULL;
+  list_init (&q->not_full);
+  list_init (&q->not_empty);
   q->head = q->tail = 0;
 }
 
-/* Returns true if Q is empty, false otherwise. */
+/* Returns true if Q is empty, false otherwise.  Unless
+   interrupts are off, the queue may change as soon as this
+   function returns. */
 bool
 intq_empty (const struct intq *q)
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return q->head == q->tail;
+  return intq_size (q) == 0;
 }
 
-/* Returns true if Q is full, false otherwise. */
+/* Returns true if Q is full, false otherwise.  Unless
+   interrupts are off, the queue may change as soon as this
+   function returns. */
 bool
 intq_full (const struct intq *q)
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return intq_size (q) == INTQ_BUFSIZE;
+}
+
+/* Returns the number of bytes in Q. */
+size_t
+intq_size (const struct intq *q)
+{
+  barrier ();
+  return q->head - q->tail;
 }
 
 /* Removes a byte from Q and returns it.
@@ -39,17 +55,12 @@ intq_getc (struct intq *q)
 {
   uint8_t byte;
 
-  ASSERT (intr_get_level () == INTR_OFF);
   while (intq_empty (q))
-    {
-      ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
-      wait (q, &q->not_empty);
-      lock_release (&q->lock);
-    }
+    wait (q, &q->not_empty);
 
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
+  byte = q->buf[pos (q->tail)];
+  barrier ();
+  q->tail++;
   signal (q, &q->not_full);
   return byte;
 }
@@ -60,55 +71,122 @@ intq_getc (struct intq *q)
 void
 intq_putc (struct intq *q, uint8_t byte)
 {
-  ASSERT (intr_get_level () == INTR_OFF);
   while (intq_full (q))
-    {
-      ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
-      wait (q, &q->not_full);
-      lock_release (&q->lock);
-    }
+    wait (q, &q->not_full);
 
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
+  q->buf[pos (q->head)] = byte;
+  barrier ();
+  q->head++;
   signal (q, &q->not_empty);
 }
-
-/* Returns the position after POS within an intq. */
-static int
-next (int pos)
+
+/* Removes up to SIZE bytes from Q into BUF, without sleeping.
+   Returns the number of bytes removed, which is 0 if Q is
+   empty. */
+size_t
+intq_get (struct intq *q, void *buf_, size_t size)
 {
-  return (pos + 1) % INTQ_BUFSIZE;
+  uint8_t *buf = buf_;
+  size_t avail = intq_size (q);
+  size_t first;
+
+  if (size > avail)
+    size = avail;
+  if (size == 0)
+    return 0;
+
+  /* Copy up to the end of the buffer, then from its start. */
+  first = INTQ_BUFSIZE - pos (q->tail);
+  if (first > size)
+    first = size;
+  memcpy (buf, q->buf + pos (q->tail), first);
+  memcpy (buf + first, q->buf, size - first);
+  barrier ();
+  q->tail += size;
+  signal (q, &q->not_full);
+  return size;
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+/* Adds up to SIZE bytes from BUF to the end of Q, without
+   sleeping.  Returns the number of bytes added, which is 0 if Q
+   is full. */
+size_t
+intq_put (struct intq *q, const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  size_t room = INTQ_BUFSIZE - intq_size (q);
+  size_t first;
+
+  if (size > room)
+    size = room;
+  if (size == 0)
+    return 0;
+
+  /* Copy up to the end of the buffer, then to its start. */
+  first = INTQ_BUFSIZE - pos (q->head);
+  if (first > size)
+    first = size;
+  memcpy (q->buf + pos (q->head), buf, first);
+  memcpy (q->buf, buf + first, size - first);
+  barrier ();
+  q->head += size;
+  signal (q, &q->not_empty);
+  return size;
+}
+
+/* Returns the position in an intq's buffer of the byte with the
+   given INDEX. */
+static size_t
+pos (unsigned index)
+{
+  return index & (INTQ_BUFSIZE - 1);
+}
+
+/* WAITERS must be Q's not_empty or not_full list.  Waits until
+   the associated condition may have become true.  The condition
+   is checked again with interrupts off before blocking, so a
+   wakeup from signal() cannot be missed. */
 static void
-wait (struct intq *q UNUSED, struct thread **waiter)
+wait (struct intq *q, struct list *waiters)
 {
+  enum intr_level old_level;
+
   ASSERT (!intr_context ());
-  ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && intq_empty (q))
-          || (waiter == &q->not_full && intq_full (q)));
+  ASSERT (waiters == &q->not_empty || waiters == &q->not_full);
 
-  *waiter = thread_current ();
-  thread_block ();
+  old_level = intr_disable ();
+  if (waiters == &q->not_empty ? intq_empty (q) : intq_full (q))
+    {
+      list_push_back (waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  intr_set_level (old_level);
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+/* WAITERS must be Q's not_empty or not_full list, and the
+   associated condition must have just become true.  Wakes up all
+   of the threads waiting for it, each of which checks it again,
+   and yields to them if one has a higher priority and the caller
+   had interrupts on.
+
+   The list is first checked without disabling interrupts.  That
+   cannot miss a waiter: a thread adds itself to the list only
+   after seeing, with interrupts off, that the condition is
+   false, and the caller has already made it true. */
 static void
-signal (struct intq *q UNUSED, struct thread **waiter)
+signal (struct intq *q UNUSED, struct list *waiters)
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-          || (waiter == &q->not_full && !intq_full (q)));
+  ASSERT (waiters == &q->not_empty || waiters == &q->not_full);
 
-  if (*waiter != NULL)
+  barrier ();
+  if (!list_empty (waiters))
     {
-      thread_unblock (*waiter);
-      *waiter = NULL;
+      enum intr_level old_level = intr_disable ();
+      while (!list_empty (waiters))
+        thread_unblock (list_entry (list_pop_front (waiters),
+                                    struct thread, elem));
+      intr_set_level (old_level);
+      if (old_level == INTR_ON)
+        thread_preempt ();
     }
 }
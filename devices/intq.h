@@ -1,43 +1,52 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <list.h>
+#include <stddef.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
 /* An "interrupt queue", a circular buffer shared between
    kernel threads and external interrupt handlers.
 
-   Interrupt queue functions can be called from kernel threads or
-   from external interrupt handlers.  Except for intq_init(),
-   interrupts must be off in either case.
+   The queue is a single-producer, single-consumer ring: one
+   context adds bytes at the head and one context removes them
+   from the tail, and each only ever writes its own index.
+   Adding and removing bytes therefore needs no locking and no
+   interrupt disabling, as long as each end is used by only one
+   context at a time.  A caller that shares an end among several
+   threads, or between threads and an interrupt handler, must
+   serialize them itself, normally by turning interrupts off.
 
-   The interrupt queue has the structure of a "monitor".  Locks
-   and condition variables from threads/synch.h cannot be used in
-   this case, as they normally would, because they can only
-   protect kernel threads from one another, not from interrupt
-   handlers. */
+   Any number of threads may block waiting for a queue to become
+   non-empty or non-full.  Blocking and waking them up briefly
+   disables interrupts. */
 
-/* Queue buffer size, in bytes. */
-#define INTQ_BUFSIZE 64
+/* Queue buffer size, in bytes.  Must be a power of 2. */
+#define INTQ_BUFSIZE 4096
 
 /* A circular queue of bytes. */
 struct intq
   {
     /* Waiting threads. */
-    struct lock lock;           /* Only one thread may wait at once. */
-    struct thread *not_full;    /* Thread waiting for not-full condition. */
-    struct thread *not_empty;   /* Thread waiting for not-empty condition. */
+    struct list not_full;       /* Threads waiting for not-full. */
+    struct list not_empty;      /* Threads waiting for not-empty. */
 
-    /* Queue. */
+    /* Queue.  HEAD and TAIL count bytes ever added and removed,
+       wrapping around at UINT_MAX; HEAD - TAIL is the number of
+       bytes in the queue. */
     uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    unsigned head;              /* Written only by the producer. */
+    unsigned tail;              /* Written only by the consumer. */
   };
 
 void intq_init (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
+size_t intq_size (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_get (struct intq *, void *, size_t);
+size_t intq_put (struct intq *, const void *, size_t);
 
 #endif /* devices/intq.h */
@@ -4,9 +4,12 @@
 #include <stdio.h>
 #include <string.h>
 #include "devices/input.h"
+#include "devices/intq.h"
 #include "devices/shutdown.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/synch.h"
+#include "threads/workqueue.h"
 
 /* Keyboard data register port. */
 #define DATA_REG 0x60
@@ -24,12 +27,27 @@ static bool caps_lock;
 /* Number of keys pressed. */
 static int64_t key_cnt;
 
+/* Scancodes read by the interrupt handler and not yet
+   translated.  The interrupt handler only reads scancodes; a
+   work item translates them into characters, with interrupts
+   on.  The work item may run on more than one worker at once,
+   so scan_lock serializes the consumer end of scan_queue and
+   the shift state above. */
+static struct intq scan_queue;
+static struct lock scan_lock;
+static struct work scan_work;
+
 static intr_handler_func keyboard_interrupt;
+static work_func translate_scancodes;
+static void translate_scancode (unsigned code);
 
 /* Initializes the keyboard. */
 void
 kbd_init (void)
 {
+  intq_init (&scan_queue);
+  lock_init (&scan_lock);
+  work_init (&scan_work, translate_scancodes, NULL);
   intr_register_ext (0x21, keyboard_interrupt, "8042 Keyboard");
 }
 
@@ -92,27 +110,61 @@ static const struct keymap shifted_keymap[] =
 
 static bool map_key (const struct keymap[], unsigned scancode, uint8_t *);
 
+/* Keyboard interrupt handler.  Reads a scancode, including its
+   second byte if it has a prefix, and leaves its translation to
+   translate_scancodes(). */
 static void
 keyboard_interrupt (struct intr_frame *args UNUSED)
+{
+  uint8_t code[2];
+  size_t n = 1;
+
+  code[0] = inb (DATA_REG);
+  if (code[0] == 0xe0)
+    code[n++] = inb (DATA_REG);
+
+  /* Drop the scancode if there is no room for all of it. */
+  if (INTQ_BUFSIZE - intq_size (&scan_queue) >= n)
+    {
+      intq_put (&scan_queue, code, n);
+      work_queue (&scan_work);
+    }
+}
+
+/* Work function that translates the scancodes in scan_queue. */
+static void
+translate_scancodes (void *aux UNUSED)
+{
+  lock_acquire (&scan_lock);
+  while (!intq_empty (&scan_queue))
+    {
+      /* The interrupt handler adds a prefix and the byte after
+         it together, so the second byte is always there. */
+      unsigned code = intq_getc (&scan_queue);
+      if (code == 0xe0)
+        code = (code << 8) | intq_getc (&scan_queue);
+      translate_scancode (code);
+    }
+  lock_release (&scan_lock);
+}
+
+/* Updates the shift state or adds a character to the input
+   buffer according to scancode CODE.  scan_lock must be held. */
+static void
+translate_scancode (unsigned code)
 {
   /* Status of shift keys. */
   bool shift = left_shift || right_shift;
   bool alt = left_alt || right_alt;
   bool ctrl = left_ctrl || right_ctrl;
 
-  /* Keyboard scancode. */
-  unsigned code;
-
   /* False if key pressed, true if key released. */
   bool release;
 
   /* Character that corresponds to `code'. */
   uint8_t c;
 
-  /* Read scancode, including second byte if prefix code. */
-  code = inb (DATA_REG);
-  if (code == 0xe0)
-    code = (code << 8) | inb (DATA_REG);
+  ASSERT (lock_held_by_current_thread (&scan_lock));
 
   /* Bit 0x80 distinguishes key press from key release
      (even if there's a prefix). */
@@ -133,6 +185,8 @@ keyboard_interrupt (struct intr_frame *args UNUSED)
       /* Ordinary character. */
       if (!release)
         {
+          enum intr_level old_level;
+
           /* Reboot if Ctrl+Alt+Del pressed. */
           if (c == 0177 && ctrl && alt)
             shutdown_reboot ();
@@ -154,11 +208,13 @@ keyboard_interrupt (struct intr_frame *args UNUSED)
             c += 0x80;
 
           /* Append to keyboard buffer. */
+          old_level = intr_disable ();
           if (!input_full ())
             {
               key_cnt++;
               input_putc (c);
             }
+          intr_set_level (old_level);
         }
     }
   else
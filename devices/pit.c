@@ -11,8 +11,14 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
+/* Read-back command, written to the control port.  Latches both
+   the status and the count of the channels selected in the low
+   bits.  See [8254] "Read-Back Command". */
+#define PIT_READ_BACK             0xc0
+#define PIT_READ_BACK_CHANNEL(CHANNEL) (2 << (CHANNEL))
+
+/* Status byte bit that reflects the channel's output pin. */
+#define PIT_STATUS_OUTPUT         0x80
 
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
@@ -81,3 +87,47 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts the given CHANNEL in the PIT counting down COUNT cycles
+   of PIT_HZ in mode 0, "interrupt on terminal count": the
+   channel's output goes high once, when the count reaches zero,
+   and stays high until the channel is reprogrammed.  For channel
+   0 this raises a single timer interrupt.  A COUNT of 0 is
+   treated as 65536. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Latches and returns the current count of the given CHANNEL in
+   the PIT.  If OUTPUT is non-null, stores the state of the
+   channel's output pin into *OUTPUT.  In mode 0, the output is
+   high once the count has expired. */
+uint16_t
+pit_read_count (int channel, bool *output)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, PIT_READ_BACK | PIT_READ_BACK_CHANNEL (channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  if (output != NULL)
+    *output = (status & PIT_STATUS_OUTPUT) != 0;
+  return lo | (hi << 8);
+}
@@ -33,6 +33,15 @@
 #define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable transmit and receive FIFOs. */
+#define FCR_CLEAR_RX 0x02       /* Clear receive FIFO. */
+#define FCR_CLEAR_TX 0x04       /* Clear transmit FIFO. */
+
+/* Size of the 16550A's transmit FIFO.  When LSR_THRE is set,
+   the FIFO is empty and this many bytes may be written at once. */
+#define TX_FIFO_SIZE 16
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
@@ -56,6 +65,7 @@ static struct intq txq;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static void fill_fifo (void);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -88,8 +98,11 @@ serial_init_queue (void)
   ASSERT (mode == POLL);
 
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
-  mode = QUEUE;
   old_level = intr_disable ();
+  while ((inb (LSR_REG) & LSR_THRE) == 0)
+    continue;
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX);
+  mode = QUEUE;
   write_ier ();
   intr_set_level (old_level);
 }
@@ -98,31 +111,56 @@ serial_init_queue (void)
 void
 serial_putc (uint8_t byte)
 {
+  serial_write (&byte, 1);
+}
+
+/* Sends the N bytes in BUFFER to the serial port. */
+void
+serial_write (const void *buffer, size_t n)
+{
+  const uint8_t *p = buffer;
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte);
+      while (n-- > 0)
+        putc_poll (*p++);
     }
   else
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq))
+      /* Otherwise, queue as many bytes as fit at once, and update
+         the interrupt enable register. */
+      while (n > 0)
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq));
+          size_t cnt = intq_put (&txq, p, n);
+          if (cnt == 0)
+            {
+              if (old_level == INTR_OFF)
+                {
+                  /* Interrupts are off and the transmit queue is
+                     full.  If we wanted to wait for the queue to
+                     empty, we'd have to reenable interrupts.
+                     That's impolite, so we'll make room by
+                     sending a FIFO's worth via polling instead. */
+                  while ((inb (LSR_REG) & LSR_THRE) == 0)
+                    continue;
+                  fill_fifo ();
+                }
+              else
+                {
+                  /* Wait for the transmit interrupt to make room. */
+                  write_ier ();
+                  intq_putc (&txq, *p);
+                  cnt = 1;
+                }
+            }
+          p += cnt;
+          n -= cnt;
         }
-
-      intq_putc (&txq, byte);
       write_ier ();
     }
 
@@ -136,7 +174,11 @@ serial_flush (void)
 {
   enum intr_level old_level = intr_disable ();
   while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+    {
+      while ((inb (LSR_REG) & LSR_THRE) == 0)
+        continue;
+      fill_fifo ();
+    }
   intr_set_level (old_level);
 }
 
@@ -205,6 +247,22 @@ putc_poll (uint8_t byte)
   outb (THR_REG, byte);
 }
 
+/* Moves up to a FIFO's worth of bytes from the transmit queue to
+   the serial port.  The transmitter must be empty, that is,
+   LSR_THRE must be set.  Before serial_init_queue() enables the
+   FIFO only a single byte fits, but then the queue is empty. */
+static void
+fill_fifo (void)
+{
+  uint8_t buf[TX_FIFO_SIZE];
+  size_t cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  cnt = intq_get (&txq, buf, mode == QUEUE ? TX_FIFO_SIZE : 1);
+  outsb (THR_REG, buf, cnt);
+}
+
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED)
@@ -218,10 +276,10 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
-    outb (THR_REG, intq_getc (&txq));
+  /* If we have bytes to transmit, and the hardware's transmit
+     FIFO is empty, refill it. */
+  if (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
+    fill_fifo ();
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
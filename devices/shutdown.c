@@ -5,7 +5,14 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/profile.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
@@ -127,12 +134,19 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  workqueue_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
+  kmem_cache_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
 #endif
+  lock_print_stats ();
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+  trace_dump ();
+  profile_dump ();
 }
@@ -1,10 +1,12 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -24,9 +26,52 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* High-resolution clock.
+
+   The CPU's time-stamp counter (TSC) counts clock cycles at a
+   rate measured against the PIT by timer_calibrate().  Cycle
+   counts since tsc_base are converted to nanoseconds as
+   (cycles * tsc_mult) >> 32, which avoids a 64-bit division on
+   every reading.  Until calibration, or if the CPU lacks a TSC,
+   the clock falls back to timer tick granularity. */
+#define NS_PER_SEC 1000000000ULL
+#define TSC_CALIBRATE_TICKS 10  /* Ticks to count cycles over. */
+static uint64_t tsc_hz;         /* TSC cycles per second, or 0. */
+static uint64_t tsc_mult;       /* 2**32 * nanoseconds per cycle. */
+static uint64_t tsc_base;       /* TSC value at tick tsc_base_ticks. */
+static int64_t tsc_base_ticks;
+
+/* List of threads blocked in timer_sleep(), ordered by
+   ascending wakeup tick.  Threads with equal wakeup ticks are
+   kept in the order in which they went to sleep.  Accessed only
+   with interrupts off. */
+static struct list sleep_list;
+
+/* Tickless idle.
+
+   When the idle thread is about to halt the CPU and nothing
+   needs to happen at the next few ticks, timer_idle_enter()
+   switches the PIT into one-shot mode so that it raises a single
+   interrupt at the tick that ends the idle period, instead of
+   one at every tick in between.  The timer interrupt then makes
+   up for the skipped ticks.  If the CPU wakes up early for some
+   other interrupt, timer_idle_exit() accounts for the ticks that
+   actually passed and restores the periodic interrupt.
+
+   The PIT's 16-bit counter limits the one-shot to about 55 ms,
+   that is, a few ticks. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+static int oneshot_ticks;       /* Ticks covered by the one-shot, or 0. */
+static uint16_t oneshot_count;  /* PIT count the one-shot started from. */
+static uint16_t oneshot_first;  /* PIT count until its first tick. */
+
 static intr_handler_func timer_interrupt;
+static void wake_sleepers (void);
+static list_less_func wakeup_less;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
+static void tsc_calibrate (void);
+static uint64_t tsc_to_ns (uint64_t cycles);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
@@ -36,6 +81,7 @@ void
 timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleep_list);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -64,6 +110,8 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  tsc_calibrate ();
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,16 +132,40 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted, with
+   the resolution of the CPU's time-stamp counter once
+   timer_calibrate() has run.  May be called from any context,
+   including interrupt handlers. */
+uint64_t
+timer_now_ns (void)
+{
+  if (tsc_hz == 0)
+    return timer_ticks () * (NS_PER_SEC / TIMER_FREQ);
+  return (tsc_base_ticks * (NS_PER_SEC / TIMER_FREQ)
+          + tsc_to_ns (rdtsc () - tsc_base));
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The running thread is blocked on sleep_list until the timer
+   interrupt handler sees that its wakeup tick has arrived, so a
+   sleeping thread consumes no CPU time at all. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_list, &cur->elem, wakeup_less, NULL);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -159,6 +231,105 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  If no sleeping thread needs to wake up at
+   the next tick, and no other per-tick work is due, programs the
+   timer to interrupt only at the end of the idle period. */
+void
+timer_idle_enter (void)
+{
+  uint16_t first;
+  int cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (oneshot_ticks != 0)
+    return;
+
+  /* Find how far away the next tick is, so that the one-shot
+     stays in phase with the periodic interrupt, and how many
+     ticks the counter can cover from there. */
+  first = pit_read_count (0, NULL);
+  if (first == 0 || first > PIT_TICK_COUNT)
+    return;
+  cnt = 1 + (UINT16_MAX - first) / PIT_TICK_COUNT;
+
+  /* Stop at the first sleeper's wakeup tick.  Under the
+     multi-level feedback queue scheduler, also stop at the next
+     second boundary, where the load average must be updated. */
+  if (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wakeup_tick - ticks < cnt)
+        cnt = t->wakeup_tick - ticks;
+    }
+  if (thread_mlfqs && TIMER_FREQ - ticks % TIMER_FREQ < cnt)
+    cnt = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (cnt < 2)
+    return;
+
+  oneshot_ticks = cnt;
+  oneshot_first = first;
+  oneshot_count = first + (cnt - 1) * PIT_TICK_COUNT;
+  pit_start_oneshot (0, oneshot_count);
+
+  /* A periodic tick that came due since interrupts were turned
+     off is still waiting in the PIC.  Its interrupt would arrive
+     as soon as we halt and be taken for the end of the one-shot,
+     adding all of its ticks at once.  The one-shot itself cannot
+     have expired yet, since it covers at least two ticks, so a
+     pending timer interrupt now must be a periodic one: go back
+     to periodic mode and let it count as the single tick it
+     is. */
+  if (intr_ext_pending (0x20))
+    {
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+}
+
+/* Called with interrupts off when the idle thread is switched
+   out.  If the timer is still in one-shot mode because the CPU
+   woke up early, adds the ticks that have passed since
+   timer_idle_enter(), wakes any threads that were due, and
+   restores the periodic interrupt.  Returns the number of ticks
+   that passed, which the caller may charge to the idle thread.
+
+   Restoring periodic mode starts a new tick period, so the tick
+   in progress is lost or, if reprogramming the PIT raises an
+   interrupt, rounded up: either way, timing is off by less than
+   one tick. */
+int
+timer_idle_exit (void)
+{
+  uint16_t count, elapsed;
+  bool expired;
+  int cnt, i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (oneshot_ticks == 0)
+    return 0;
+
+  /* If the one-shot already expired, its interrupt is pending and
+     timer_interrupt() will do the bookkeeping. */
+  count = pit_read_count (0, &expired);
+  if (expired)
+    return 0;
+
+  elapsed = oneshot_count - count;
+  cnt = elapsed < oneshot_first ? 0
+        : 1 + (elapsed - oneshot_first) / PIT_TICK_COUNT;
+  oneshot_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  for (i = 0; i < cnt; i++)
+    {
+      ticks++;
+      wake_sleepers ();
+    }
+  return cnt;
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void)
@@ -166,12 +337,56 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
+/* Timer interrupt handler.  If the interrupt ends a tickless
+   idle period, catches up on every tick it covered. */
+static void
+timer_interrupt (struct intr_frame *args)
+{
+  int cnt = 1;
+
+  profile_sample (args);
+  if (oneshot_ticks != 0)
+    {
+      cnt = oneshot_ticks;
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  while (cnt-- > 0)
+    {
+      ticks++;
+      wake_sleepers ();
+      thread_tick ();
+    }
+}
+
+/* Wakes up every sleeping thread whose wakeup tick has arrived.
+   Because sleep_list is sorted, this examines only the expiring
+   threads plus one more. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+wake_sleepers (void)
+{
+  while (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wakeup_tick > ticks)
+        break;
+      list_pop_front (&sleep_list);
+      thread_unblock (t);
+    }
+}
+
+/* Returns true if sleeping thread A should wake up before
+   sleeping thread B, false otherwise. */
+static bool
+wakeup_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->wakeup_tick < b->wakeup_tick;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -224,8 +439,17 @@ real_time_sleep (int64_t num, int32_t denom)
     {
       /* We're waiting for at least one full timer tick.  Use
          timer_sleep() because it will yield the CPU to other
-         processes. */
+         processes.  With the high-resolution clock, we can then
+         make up the fraction of a tick that timer_sleep() missed
+         by busy-waiting for it. */
+      uint64_t end = timer_now_ns () + num * (NS_PER_SEC / denom);
       timer_sleep (ticks);
+      if (tsc_hz != 0)
+        {
+          uint64_t now = timer_now_ns ();
+          if (now < end && end - now < NS_PER_SEC / TIMER_FREQ)
+            real_time_delay (end - now, NS_PER_SEC);
+        }
     }
   else
     {
@@ -242,5 +466,63 @@ real_time_delay (int64_t num, int32_t denom)
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+
+  if (tsc_hz != 0)
+    {
+      /* Spin on the time-stamp counter, which is immune to the
+         code alignment and interrupt effects that make
+         loops_per_tick approximate. */
+      uint64_t start = rdtsc ();
+      uint64_t cycles = tsc_hz * num / 1000 / (denom / 1000);
+      while (rdtsc () - start < cycles)
+        barrier ();
+    }
+  else
+    busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+}
+
+/* Measures the rate of the CPU's time-stamp counter by counting
+   cycles over TSC_CALIBRATE_TICKS timer ticks, if the CPU has
+   one.  Interrupts must be on. */
+static void
+tsc_calibrate (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  uint64_t start;
+  int64_t start_ticks;
+
+  /* CPUID function 1 reports TSC support in EDX bit 4.  See
+     [IA32-v2a] "CPUID". */
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                        : "a" (1));
+  if ((edx & (1u << 4)) == 0)
+    return;
+
+  /* Count cycles between two timer tick edges. */
+  start_ticks = ticks;
+  while (ticks == start_ticks)
+    barrier ();
+  start = rdtsc ();
+  start_ticks = ticks;
+  while (ticks - start_ticks < TSC_CALIBRATE_TICKS)
+    barrier ();
+
+  tsc_hz = (rdtsc () - start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+  tsc_mult = (NS_PER_SEC << 32) / tsc_hz;
+  tsc_base = start;
+  tsc_base_ticks = start_ticks;
+  printf ("Timer: %'"PRIu64" TSC cycles/s.\n", tsc_hz);
+}
+
+/* Converts a count of TSC CYCLES to nanoseconds, computing
+   (CYCLES * tsc_mult) >> 32 from 32x32-bit products so that the
+   intermediate result cannot overflow. */
+static uint64_t
+tsc_to_ns (uint64_t cycles)
+{
+  uint32_t ch = cycles >> 32, cl = cycles;
+  uint32_t mh = tsc_mult >> 32, ml = tsc_mult;
+
+  return ((((uint64_t) ch * mh) << 32) + (uint64_t) ch * ml
+          + (uint64_t) cl * mh + (((uint64_t) cl * ml) >> 32));
 }
@@ -1,4 +1,5 @@
 #include "devices/vga.h"
+#include <debug.h>
 #include <round.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -26,6 +27,7 @@ static size_t cx, cy;
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void put_char (int c, enum intr_level old_level);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
@@ -56,6 +58,36 @@ vga_putc (int c)
   enum intr_level old_level = intr_disable ();
 
   init ();
+  put_char (c, old_level);
+
+  /* Update cursor position. */
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes the N characters in BUFFER to the VGA text display, as
+   if by vga_putc(), but moves the hardware cursor only once. */
+void
+vga_write (const char *buffer, size_t n)
+{
+  enum intr_level old_level = intr_disable ();
+
+  init ();
+  while (n-- > 0)
+    put_char (*buffer++, old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C to the framebuffer, interpreting control characters,
+   without moving the hardware cursor.  Interrupts must be off;
+   OLD_LEVEL is the level to restore while beeping. */
+static void
+put_char (int c, enum intr_level old_level)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
 
   switch (c)
     {
@@ -95,11 +127,6 @@ vga_putc (int c)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
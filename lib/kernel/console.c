@@ -1,6 +1,7 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
@@ -9,6 +10,26 @@
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
+
+/* Output from vprintf() is formatted into a line buffer on the
+   calling thread's stack, without holding the console lock, and
+   written out a whole line at a time.  Lines longer than the
+   buffer are written out in pieces, and the console lock is
+   held from the first piece until the end of the line, so that
+   even a long line is not mixed with other threads' output. */
+#define LINE_BUFSIZE 128
+
+/* A vprintf() line buffer. */
+struct line_buffer
+  {
+    char buf[LINE_BUFSIZE];     /* Characters not yet written. */
+    size_t len;                 /* Number of characters in BUF. */
+    int char_cnt;               /* Total characters formatted. */
+    bool locked;                /* Holding the console lock? */
+  };
+
+static void flush_line (struct line_buffer *, bool line_done);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -63,7 +84,7 @@ static int64_t write_cnt;
 void
 console_init (void)
 {
-  lock_init (&console_lock);
+  lock_init_named (&console_lock, "console");
   use_console_lock = true;
 }
 
@@ -121,17 +142,25 @@ console_locked_by_current_thread (void)
 
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
-   Writes its output to both vga display and serial port. */
+   Writes its output to both vga display and serial port.
+
+   The console lock is taken only to write out each complete
+   line, or from the first piece of a line too long for the line
+   buffer until its end, so threads that print at the same time
+   do not wait for each other's formatting, and lines from
+   different threads are not mixed. */
 int
 vprintf (const char *format, va_list args)
 {
-  int char_cnt = 0;
+  struct line_buffer lb;
 
-  acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
-  release_console ();
+  lb.len = 0;
+  lb.char_cnt = 0;
+  lb.locked = false;
+  __vprintf (format, args, vprintf_helper, &lb);
+  flush_line (&lb, true);
 
-  return char_cnt;
+  return lb.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -140,8 +169,7 @@ int
 puts (const char *s)
 {
   acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
+  putbuf_have_lock (s, strlen (s));
   putchar_have_lock ('\n');
   release_console ();
 
@@ -153,8 +181,7 @@ void
 putbuf (const char *buffer, size_t n)
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -169,13 +196,43 @@ putchar (int c)
   return c;
 }
 
-/* Helper function for vprintf(). */
+/* Helper function for vprintf().  Adds C to line buffer LB_,
+   writing out the buffer at the end of each line or when it
+   fills up. */
 static void
-vprintf_helper (char c, void *char_cnt_)
+vprintf_helper (char c, void *lb_)
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct line_buffer *lb = lb_;
+
+  lb->char_cnt++;
+  lb->buf[lb->len++] = c;
+  if (c == '\n')
+    flush_line (lb, true);
+  else if (lb->len >= sizeof lb->buf)
+    flush_line (lb, false);
+}
+
+/* Writes out and empties line buffer LB.  If LINE_DONE is false,
+   LB holds only part of a line, so keeps the console lock until
+   a later call writes out the rest of it. */
+static void
+flush_line (struct line_buffer *lb, bool line_done)
+{
+  if (lb->len > 0)
+    {
+      if (!lb->locked)
+        {
+          acquire_console ();
+          lb->locked = true;
+        }
+      putbuf_have_lock (lb->buf, lb->len);
+      lb->len = 0;
+    }
+  if (line_done && lb->locked)
+    {
+      release_console ();
+      lb->locked = false;
+    }
 }
 
 /* Writes C to the vga display and serial port.
@@ -189,3 +246,15 @@ putchar_have_lock (uint8_t c)
   serial_putc (c);
   vga_putc (c);
 }
+
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, handing them to each all at once.  The caller
+   has already acquired the console lock if appropriate. */
+static void
+putbuf_have_lock (const char *buffer, size_t n)
+{
+  ASSERT (console_locked_by_current_thread ());
+  write_cnt += n;
+  serial_write (buffer, n);
+  vga_write (buffer, n);
+}
@@ -93,10 +93,11 @@ print_stacktrace(struct thread *t, void *aux UNUSED)
       /* Skip threads if they have been added to the all threads
          list, but have never been scheduled.
          We can identify because their `stack' member either points
-         at the top of their kernel stack page, or the
+         at the top of their kernel stack, or the
          switch_threads_frame's 'eip' member points at switch_entry.
          See also threads.c. */
-      if (t->stack == (uint8_t *)t + PGSIZE || saved_frame->eip == switch_entry)
+      if (t->stack == thread_stack_top (t)
+          || saved_frame->eip == switch_entry)
         {
           printf (" thread was never scheduled.\n");
           return;
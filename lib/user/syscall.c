@@ -182,3 +182,11 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+uint64_t
+clock_ns (void)
+{
+  uint64_t ns;
+  syscall1 (SYS_CLOCK_NS, &ns);
+  return ns;
+}
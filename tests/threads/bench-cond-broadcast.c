@@ -0,0 +1,92 @@
+/* Measures condition variable broadcast fan-out.  BENCH_WAITERS
+   threads wait on a condition variable, and the main thread
+   broadcasts to them BENCH_ROUNDS times, each time waiting until
+   every waiter has woken up and acknowledged before the next
+   round. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BENCH_WAITERS 8
+#define BENCH_ROUNDS 500
+
+struct fanout
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition go;        /* Broadcast once per round. */
+    struct condition acked;     /* Signaled when all have woken. */
+    int round;                  /* Current round number. */
+    int acks;                   /* Waiters woken this round. */
+    bool stop;                  /* True when the waiters should exit. */
+    struct semaphore done;      /* Upped by each waiter as it exits. */
+  };
+
+static thread_func waiter_thread;
+
+void
+test_bench_cond_broadcast (void) 
+{
+  struct fanout f;
+  uint64_t start, elapsed;
+  int i;
+
+  lock_init (&f.lock);
+  cond_init (&f.go);
+  cond_init (&f.acked);
+  f.round = 0;
+  f.acks = 0;
+  f.stop = false;
+  sema_init (&f.done, 0);
+
+  for (i = 0; i < BENCH_WAITERS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "waiter %d", i);
+      thread_create (name, thread_get_priority (), waiter_thread, &f);
+    }
+
+  start = timer_now_ns ();
+  lock_acquire (&f.lock);
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+      f.round++;
+      f.acks = 0;
+      cond_broadcast (&f.go, &f.lock);
+      while (f.acks < BENCH_WAITERS)
+        cond_wait (&f.acked, &f.lock);
+    }
+  elapsed = timer_now_ns () - start;
+
+  f.stop = true;
+  cond_broadcast (&f.go, &f.lock);
+  lock_release (&f.lock);
+  for (i = 0; i < BENCH_WAITERS; i++)
+    sema_down (&f.done);
+
+  bench_result ("broadcast_round", elapsed / BENCH_ROUNDS, "ns");
+  bench_result ("wakeup", elapsed / (BENCH_ROUNDS * BENCH_WAITERS), "ns");
+}
+
+static void
+waiter_thread (void *f_) 
+{
+  struct fanout *f = f_;
+  int seen = 0;
+
+  lock_acquire (&f->lock);
+  for (;;)
+    {
+      while (f->round == seen && !f->stop)
+        cond_wait (&f->go, &f->lock);
+      if (f->stop)
+        break;
+      seen = f->round;
+      if (++f->acks == BENCH_WAITERS)
+        cond_signal (&f->acked, &f->lock);
+    }
+  lock_release (&f->lock);
+  sema_up (&f->done);
+}
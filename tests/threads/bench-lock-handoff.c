@@ -0,0 +1,67 @@
+/* Measures lock throughput under contention.  BENCH_THREADS
+   threads of equal priority each acquire and release the same
+   lock BENCH_ITERS times, yielding the CPU while they hold it so
+   that the others pile up waiting and every release must wake a
+   waiter. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BENCH_THREADS 4
+#define BENCH_ITERS 2500
+
+struct handoff
+  {
+    struct lock lock;           /* The contended lock. */
+    int acquisitions;           /* Protected by LOCK. */
+    struct semaphore done;      /* Upped by each thread as it exits. */
+  };
+
+static thread_func handoff_thread;
+
+void
+test_bench_lock_handoff (void) 
+{
+  struct handoff h;
+  uint64_t start, elapsed;
+  int i;
+
+  lock_init (&h.lock);
+  h.acquisitions = 0;
+  sema_init (&h.done, 0);
+
+  start = timer_now_ns ();
+  for (i = 0; i < BENCH_THREADS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "handoff %d", i);
+      thread_create (name, thread_get_priority (), handoff_thread, &h);
+    }
+  for (i = 0; i < BENCH_THREADS; i++)
+    sema_down (&h.done);
+  elapsed = timer_now_ns () - start;
+
+  if (h.acquisitions != BENCH_THREADS * BENCH_ITERS)
+    fail ("lock acquired %d times, expected %d",
+          h.acquisitions, BENCH_THREADS * BENCH_ITERS);
+  bench_result ("acquire_release", elapsed / h.acquisitions, "ns");
+}
+
+static void
+handoff_thread (void *h_) 
+{
+  struct handoff *h = h_;
+  int i;
+
+  for (i = 0; i < BENCH_ITERS; i++)
+    {
+      lock_acquire (&h->lock);
+      h->acquisitions++;
+      thread_yield ();
+      lock_release (&h->lock);
+    }
+  sema_up (&h->done);
+}
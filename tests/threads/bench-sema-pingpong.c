@@ -0,0 +1,60 @@
+/* Measures semaphore round-trip latency.  Two threads of equal
+   priority pass control back and forth through a pair of
+   semaphores BENCH_ROUNDS times, so each round trip costs two
+   sema_up() calls, two sema_down() calls that block, and two
+   context switches. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BENCH_ROUNDS 10000
+
+struct pingpong
+  {
+    struct semaphore ping;      /* Upped by the main thread. */
+    struct semaphore pong;      /* Upped by the partner. */
+  };
+
+static thread_func pong_thread;
+
+void
+test_bench_sema_pingpong (void) 
+{
+  struct pingpong pp;
+  uint64_t start, elapsed;
+  int i;
+
+  sema_init (&pp.ping, 0);
+  sema_init (&pp.pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, &pp);
+
+  /* Let the partner block on PING before starting the clock. */
+  sema_up (&pp.ping);
+  sema_down (&pp.pong);
+
+  start = timer_now_ns ();
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+      sema_up (&pp.ping);
+      sema_down (&pp.pong);
+    }
+  elapsed = timer_now_ns () - start;
+
+  bench_result ("round_trip", elapsed / BENCH_ROUNDS, "ns");
+}
+
+static void
+pong_thread (void *pp_) 
+{
+  struct pingpong *pp = pp_;
+  int i;
+
+  for (i = 0; i < BENCH_ROUNDS + 1; i++)
+    {
+      sema_down (&pp->ping);
+      sema_up (&pp->pong);
+    }
+}
@@ -0,0 +1,41 @@
+/* Measures how quickly threads can be created and joined, by
+   creating BENCH_THREADS short-lived threads one after another
+   and waiting for each to exit before creating the next. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BENCH_THREADS 1000
+
+static thread_func exit_thread;
+
+void
+test_bench_thread_create (void) 
+{
+  struct semaphore done;
+  uint64_t start, elapsed;
+  int i;
+
+  sema_init (&done, 0);
+  start = timer_now_ns ();
+  for (i = 0; i < BENCH_THREADS; i++)
+    {
+      if (thread_create ("bench", PRI_DEFAULT, exit_thread, &done)
+          == TID_ERROR)
+        fail ("thread_create failed after %d threads", i);
+      sema_down (&done);
+    }
+  elapsed = timer_now_ns () - start;
+
+  bench_result ("create_join", elapsed / BENCH_THREADS, "ns");
+}
+
+static void
+exit_thread (void *done) 
+{
+  sema_up (done);
+}
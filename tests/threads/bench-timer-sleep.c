@@ -0,0 +1,52 @@
+/* Measures how accurately timer_sleep() wakes up.  Sleeps of
+   several lengths are each repeated BENCH_REPS times, starting
+   just after a timer tick, and the time actually slept is
+   compared against the requested number of ticks.  A sleeping
+   thread can only wake on a tick, so the error mostly reflects
+   the latency from the timer interrupt to the thread running. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BENCH_REPS 20
+
+void
+test_bench_timer_sleep (void) 
+{
+  static const int lengths[] = {1, 2, 5, 10};
+  size_t i;
+
+  for (i = 0; i < sizeof lengths / sizeof *lengths; i++)
+    {
+      int ticks = lengths[i];
+      uint64_t expected = ticks * (1000000000 / TIMER_FREQ);
+      uint64_t total_err = 0;
+      uint64_t max_err = 0;
+      char metric[32];
+      int rep;
+
+      for (rep = 0; rep < BENCH_REPS; rep++)
+        {
+          uint64_t start, slept, err;
+
+          /* Start right after a tick, so that a sleep of TICKS
+             ticks should last TICKS full tick periods. */
+          timer_sleep (1);
+          start = timer_now_ns ();
+          timer_sleep (ticks);
+          slept = timer_now_ns () - start;
+
+          err = slept > expected ? slept - expected : expected - slept;
+          total_err += err;
+          if (err > max_err)
+            max_err = err;
+        }
+
+      snprintf (metric, sizeof metric, "sleep_%d_mean_error", ticks);
+      bench_result (metric, total_err / BENCH_REPS / 1000, "us");
+      snprintf (metric, sizeof metric, "sleep_%d_max_error", ticks);
+      bench_result (metric, max_err / 1000, "us");
+    }
+}
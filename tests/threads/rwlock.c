@@ -0,0 +1,55 @@
+/* Checks that a writer waiting for a readers-writer lock keeps
+   later readers out, even higher-priority ones, and that it gets
+   the lock as soon as the last earlier reader releases it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread;
+static thread_func reader_thread;
+
+void
+test_rwlock (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rwlock_acquire_read (&rw);
+  msg ("main acquired read lock.");
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread, &rw);
+  thread_create ("reader", PRI_DEFAULT + 2, reader_thread, &rw);
+  msg ("main releasing read lock.");
+  rwlock_release_read (&rw);
+  msg ("main done.");
+}
+
+static void
+writer_thread (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_write (rw);
+  msg ("writer acquired write lock.");
+  rwlock_release_write (rw);
+  msg ("writer done.");
+}
+
+static void
+reader_thread (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_read (rw);
+  msg ("reader acquired read lock.");
+  rwlock_release_read (rw);
+  msg ("reader done.");
+}
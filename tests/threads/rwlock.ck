@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock) begin
+(rwlock) main acquired read lock.
+(rwlock) main releasing read lock.
+(rwlock) writer acquired write lock.
+(rwlock) reader acquired read lock.
+(rwlock) reader done.
+(rwlock) writer done.
+(rwlock) main done.
+(rwlock) end
+EOF
+pass;
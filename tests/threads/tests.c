@@ -1,5 +1,6 @@
 #include "tests/threads/tests.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -39,6 +40,13 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"rwlock", test_rwlock},
+    {"workqueue", test_workqueue},
+    {"bench-sema-pingpong", test_bench_sema_pingpong},
+    {"bench-lock-handoff", test_bench_lock_handoff},
+    {"bench-cond-broadcast", test_bench_cond_broadcast},
+    {"bench-thread-create", test_bench_thread_create},
+    {"bench-timer-sleep", test_bench_timer_sleep},
   };
 
 static const char *test_name;
@@ -94,6 +102,15 @@ fail (const char *format, ...)
   PANIC ("test failed");
 }
 
+/* Prints a benchmark result, the VALUE of METRIC measured in
+   UNIT, on a line of its own in a fixed format that scripts can
+   parse: "(TEST) result METRIC VALUE UNIT". */
+void
+bench_result (const char *metric, uint64_t value, const char *unit) 
+{
+  msg ("result %s %"PRIu64" %s", metric, value, unit);
+}
+
 /* Prints a message indicating the current test passed. */
 void
 pass (void) 
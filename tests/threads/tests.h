@@ -1,6 +1,8 @@
 #ifndef TESTS_THREADS_TESTS_H
 #define TESTS_THREADS_TESTS_H
 
+#include <stdint.h>
+
 void run_test (const char *);
 
 typedef void test_func (void);
@@ -33,10 +35,18 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_rwlock;
+extern test_func test_workqueue;
+extern test_func test_bench_sema_pingpong;
+extern test_func test_bench_lock_handoff;
+extern test_func test_bench_cond_broadcast;
+extern test_func test_bench_thread_create;
+extern test_func test_bench_timer_sleep;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
 void pass (void);
+void bench_result (const char *metric, uint64_t value, const char *unit);
 
 #endif /* tests/threads/tests.h */
 
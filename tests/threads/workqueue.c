@@ -0,0 +1,54 @@
+/* Queues several work items and checks that each runs exactly
+   once and that queuing an item that is already pending has no
+   effect.  Items may run concurrently on different workers, so
+   the order in which they run is not checked. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/workqueue.h"
+
+#define WORK_CNT 5
+
+static work_func workqueue_func;
+static struct semaphore done;
+static int run_cnt[WORK_CNT];
+
+void
+test_workqueue (void) 
+{
+  struct work works[WORK_CNT];
+  enum intr_level old_level;
+  int i;
+
+  sema_init (&done, 0);
+  for (i = 0; i < WORK_CNT; i++)
+    work_init (&works[i], workqueue_func, (void *) i);
+
+  /* Queue every item before any of them can run. */
+  old_level = intr_disable ();
+  for (i = 0; i < WORK_CNT; i++)
+    if (!work_queue (&works[i]))
+      fail ("work %d not queued", i);
+  if (work_queue (&works[0]))
+    fail ("pending work 0 queued twice");
+  intr_set_level (old_level);
+
+  for (i = 0; i < WORK_CNT; i++)
+    sema_down (&done);
+  for (i = 0; i < WORK_CNT; i++)
+    if (run_cnt[i] != 1)
+      fail ("work %d ran %d times", i, run_cnt[i]);
+    else
+      msg ("work %d ran once", i);
+}
+
+static void
+workqueue_func (void *aux) 
+{
+  enum intr_level old_level = intr_disable ();
+  run_cnt[(int) aux]++;
+  intr_set_level (old_level);
+  sema_up (&done);
+}
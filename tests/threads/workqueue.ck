@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(workqueue) begin
+(workqueue) work 0 ran once
+(workqueue) work 1 ran once
+(workqueue) work 2 ran once
+(workqueue) work 3 ran once
+(workqueue) work 4 ran once
+(workqueue) end
+EOF
+pass;
@@ -0,0 +1,100 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed fixed-point real numbers in 17.14 format: the low 14
+   bits of an int hold the fraction, the next 17 bits the integer
+   part, and the top bit the sign.  Used by the multi-level
+   feedback queue scheduler, because the kernel does not support
+   floating-point arithmetic.
+
+   X and Y below are fixed-point numbers, N is an integer. */
+typedef int fixed_t;
+
+/* Number of fraction bits. */
+#define FIX_FBITS 14
+
+/* 1.0 in fixed-point. */
+#define FIX_ONE (1 << FIX_FBITS)
+
+/* Converts N to fixed-point. */
+static inline fixed_t
+fix_int (int n)
+{
+  return n * FIX_ONE;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+fix_trunc (fixed_t x)
+{
+  return x / FIX_ONE;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fix_round (fixed_t x)
+{
+  return x >= 0 ? (x + FIX_ONE / 2) / FIX_ONE : (x - FIX_ONE / 2) / FIX_ONE;
+}
+
+/* Returns X + Y. */
+static inline fixed_t
+fix_add (fixed_t x, fixed_t y)
+{
+  return x + y;
+}
+
+/* Returns X - Y. */
+static inline fixed_t
+fix_sub (fixed_t x, fixed_t y)
+{
+  return x - y;
+}
+
+/* Returns X + N. */
+static inline fixed_t
+fix_add_int (fixed_t x, int n)
+{
+  return x + n * FIX_ONE;
+}
+
+/* Returns X - N. */
+static inline fixed_t
+fix_sub_int (fixed_t x, int n)
+{
+  return x - n * FIX_ONE;
+}
+
+/* Returns X * Y.  The product is formed in 64 bits so that it
+   cannot overflow before it is scaled back down. */
+static inline fixed_t
+fix_mul (fixed_t x, fixed_t y)
+{
+  return ((int64_t) x) * y / FIX_ONE;
+}
+
+/* Returns X * N. */
+static inline fixed_t
+fix_mul_int (fixed_t x, int n)
+{
+  return x * n;
+}
+
+/* Returns X / Y.  The dividend is scaled up in 64 bits so that
+   no fraction bits are lost. */
+static inline fixed_t
+fix_div (fixed_t x, fixed_t y)
+{
+  return ((int64_t) x) * FIX_ONE / y;
+}
+
+/* Returns X / N. */
+static inline fixed_t
+fix_div_int (fixed_t x, int n)
+{
+  return x / n;
+}
+
+#endif /* threads/fixed-point.h */
@@ -20,8 +20,12 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -98,6 +102,8 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  trace_init ();
+  profile_init ();
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -107,6 +113,7 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  workqueue_init ();
   timer_init ();
   kbd_init ();
   input_init ();
@@ -117,6 +124,7 @@ main (void)
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  workqueue_start ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -256,6 +264,16 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-trace"))
+        trace_enabled = true;
+      else if (!strcmp (name, "-thread-stats"))
+        thread_stats = true;
+      else if (!strcmp (name, "-lockstat"))
+        lock_profiling = true;
+      else if (!strcmp (name, "-profile"))
+        profile_enabled = true;
+      else if (!strcmp (name, "-alloc-sites"))
+        alloc_tracking = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -292,6 +310,13 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints the scheduler trace recorded so far. */
+static void
+run_trace_dump (char **argv UNUSED)
+{
+  trace_dump ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -309,6 +334,7 @@ run_actions (char **argv)
   static const struct action actions[] =
     {
       {"run", 2, run_task},
+      {"trace-dump", 1, run_trace_dump},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -357,6 +383,7 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  trace-dump         Print the scheduler trace (see -trace).\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -379,6 +406,11 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -trace             Record scheduler events, print at shutdown.\n"
+          "  -thread-stats      Print each thread's CPU and wait times at exit.\n"
+          "  -lockstat          Print lock contention statistics at shutdown.\n"
+          "  -profile           Sample CPU at each tick, print at shutdown.\n"
+          "  -alloc-sites       Report memory held by each call site at shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -54,6 +54,7 @@ static void pic_end_of_interrupt (int irq);
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
+static uint64_t make_task_gate (uint16_t tss_sel);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /* Interrupt handlers. */
@@ -206,6 +207,22 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers internal interrupt VEC_NO to switch to the task
+   whose task-state segment has selector TSS_SEL, which is named
+   NAME for debugging purposes.  Unlike an ordinary handler, the
+   task runs on its own stack, so it works even if the
+   interrupted thread's stack pointer is invalid.  See [IA32-v3a]
+   6.3 "Task Switching". */
+void
+intr_register_task (uint8_t vec_no, uint16_t tss_sel, const char *name)
+{
+  ASSERT (vec_no < 0x20);
+  ASSERT (intr_handlers[vec_no] == NULL);
+
+  idt[vec_no] = make_task_gate (tss_sel);
+  intr_names[vec_no] = name;
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -225,6 +242,29 @@ intr_yield_on_return (void)
   yield_on_return = true;
 }
 
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet acknowledged, that is, if it is waiting in the PIC for
+   interrupts to be turned on or if its handler is running.
+   Interrupts should be off, or the answer may already be out of
+   date. */
+bool
+intr_ext_pending (uint8_t vec_no)
+{
+  int port = vec_no < 0x28 ? PIC0_CTRL : PIC1_CTRL;
+  uint8_t bit = 1u << (vec_no & 7);
+  uint8_t irr, isr;
+
+  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+
+  /* OCW3: select the request register, then the in-service
+     register, for the next read of the control port. */
+  outb (port, 0x0a);
+  irr = inb (port);
+  outb (port, 0x0b);
+  isr = inb (port);
+  return ((irr | isr) & bit) != 0;
+}
+
 /* 8259A Programmable Interrupt Controller. */
 
 /* Initializes the PICs.  Refer to [8259A] for details.
@@ -327,6 +367,22 @@ make_trap_gate (void (*function) (void), int dpl)
   return make_gate (function, dpl, 15);
 }
 
+/* Creates a task gate that switches to the task whose task-state
+   segment has selector TSS_SEL.  Only the kernel may invoke it
+   intentionally. */
+static uint64_t
+make_task_gate (uint16_t tss_sel)
+{
+  uint32_t e0, e1;
+
+  e0 = (uint32_t) tss_sel << 16;        /* TSS segment selector. */
+  e1 = ((1 << 15)                       /* Present. */
+        | (0 << 13)                     /* Descriptor privilege level. */
+        | (5 << 8));                    /* Task gate. */
+
+  return e0 | ((uint64_t) e1 << 32);
+}
+
 /* Returns a descriptor that yields the given LIMIT and BASE when
    used as an operand for the LIDT instruction. */
 static inline uint64_t
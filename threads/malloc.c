@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,7 +33,30 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor's free list sits a "magazine", a
+   small stack of free blocks protected only by disabling
+   interrupts, so that most calls to malloc() and free() need
+   not take the descriptor's lock.  When the magazine is empty,
+   malloc() refills half of it from the free list in one go, and
+   when it is full, free() moves half of it back.  Blocks in the
+   magazine still count as in use in their arenas, so they can
+   keep otherwise unused arenas alive.  When the page allocator
+   runs out of kernel pages, it calls malloc_reap() to move every
+   magazine's blocks back to the free lists, freeing any arenas
+   that become unused.
+
+   If alloc_tracking (see palloc.h) is true, every allocation is
+   preceded by a tag that records the code that allocated it, and
+   the tags of all live allocations are kept on a list, so that
+   malloc_print_stats() can report which call sites hold memory
+   at shutdown. */
+
+/* Magazine capacity, and the number of blocks moved between the
+   magazine and the free list at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
 
 /* Descriptor. */
 struct desc
@@ -41,6 +65,13 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Magazine, protected by disabling interrupts. */
+    struct block *mag[MAG_SIZE]; /* Free blocks, not on free_list. */
+    size_t mag_cnt;             /* Number of blocks in MAG. */
+    long long mag_hits;         /* Allocations served from MAG. */
+    long long mag_misses;       /* Allocations that took LOCK. */
+    size_t arena_cnt;           /* Number of arenas, protected by LOCK. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -64,8 +95,34 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Big blocks, protected by disabling interrupts. */
+static size_t big_cnt;          /* Number of live big blocks. */
+static size_t big_pages;        /* Pages in live big blocks. */
+static size_t big_peak_pages;   /* Most pages ever in big blocks. */
+
+/* Tag that precedes each allocation if alloc_tracking. */
+struct alloc_tag
+  {
+    struct list_elem elem;      /* Element in live_tags. */
+    void *caller;               /* Code that allocated the block. */
+    size_t size;                /* Requested size in bytes. */
+  };
+
+/* Tags of live allocations, protected by disabling interrupts. */
+static struct list live_tags;
+
+/* Maximum number of distinct call sites in a usage report. */
+#define SITE_MAX 32
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *mag_pop (struct desc *);
+static bool mag_push (struct desc *, struct block *);
+static void release_block (struct desc *, struct block *);
+static void *malloc_at (size_t, void *caller);
+static void *alloc_block (size_t);
+static void free_block (void *);
+static void print_sites (void);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,22 +133,64 @@ malloc_init (void)
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
+      char name[16];
+
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      d->mag_cnt = 0;
+      d->mag_hits = d->mag_misses = 0;
+      d->arena_cnt = 0;
+      snprintf (name, sizeof name, "malloc %zu", block_size);
+      lock_init_named (&d->lock, name);
     }
+  list_init (&live_tags);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size)
+{
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Implements malloc() on behalf of the code at CALLER, adding a
+   tag if alloc_tracking is true. */
+static void *
+malloc_at (size_t size, void *caller)
+{
+  struct alloc_tag *t;
+  enum intr_level old_level;
+
+  if (!alloc_tracking)
+    return alloc_block (size);
+
+  if (size == 0 || size > SIZE_MAX - sizeof *t)
+    return NULL;
+  t = alloc_block (size + sizeof *t);
+  if (t == NULL)
+    return NULL;
+
+  t->caller = caller;
+  t->size = size;
+  old_level = intr_disable ();
+  list_push_back (&live_tags, &t->elem);
+  intr_set_level (old_level);
+  return t + 1;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes,
+   without a tag.  Returns a null pointer if memory is not
+   available. */
+static void *
+alloc_block (size_t size)
 {
   struct desc *d;
   struct block *b;
   struct arena *a;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -116,10 +215,23 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+
+      old_level = intr_disable ();
+      big_cnt++;
+      big_pages += page_cnt;
+      if (big_pages > big_peak_pages)
+        big_peak_pages = big_pages;
+      intr_set_level (old_level);
       return a + 1;
     }
 
+  /* Try the magazine first. */
+  b = mag_pop (d);
+  if (b != NULL)
+    return b;
+
   lock_acquire (&d->lock);
+  d->mag_misses++;
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -135,6 +247,7 @@ malloc (size_t size)
         }
 
       /* Initialize arena and add its blocks to the free list. */
+      d->arena_cnt++;
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
@@ -145,10 +258,22 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
+  /* Get a block from free list, then refill the magazine from
+     whatever else is on the free list. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
+  while (d->mag_cnt < MAG_BATCH && !list_empty (&d->free_list))
+    {
+      struct block *extra = list_entry (list_pop_front (&d->free_list),
+                                        struct block, free_elem);
+      if (!mag_push (d, extra))
+        {
+          list_push_front (&d->free_list, &extra->free_elem);
+          break;
+        }
+      block_to_arena (extra)->free_cnt--;
+    }
   lock_release (&d->lock);
   return b;
 }
@@ -167,7 +292,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,10 +326,12 @@ realloc (void *old_block, size_t new_size)
     }
   else
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_at (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
+          size_t old_size = (alloc_tracking
+                             ? ((struct alloc_tag *) old_block - 1)->size
+                             : block_size (old_block));
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
@@ -217,6 +344,21 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p)
+{
+  if (p != NULL && alloc_tracking)
+    {
+      struct alloc_tag *t = (struct alloc_tag *) p - 1;
+      enum intr_level old_level = intr_disable ();
+      list_remove (&t->elem);
+      intr_set_level (old_level);
+      p = t;
+    }
+  free_block (p);
+}
+
+/* Frees block P, which has no tag. */
+static void
+free_block (void *p)
 {
   if (p != NULL)
     {
@@ -227,42 +369,244 @@ free (void *p)
       if (d != NULL)
         {
           /* It's a normal block.  We handle it here. */
+          struct block *flush[MAG_BATCH];
+          enum intr_level old_level;
+          size_t flush_cnt = 0;
+          size_t i;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
 
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena)
+          /* Put the block in the magazine.  If the magazine is
+             full, first take out the oldest half of it to give
+             back to the free list. */
+          old_level = intr_disable ();
+          if (d->mag_cnt >= MAG_SIZE)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++)
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              flush_cnt = MAG_BATCH;
+              memcpy (flush, d->mag, sizeof flush);
+              d->mag_cnt -= MAG_BATCH;
+              memmove (d->mag, d->mag + MAG_BATCH,
+                       d->mag_cnt * sizeof *d->mag);
             }
+          d->mag[d->mag_cnt++] = b;
+          intr_set_level (old_level);
 
-          lock_release (&d->lock);
+          if (flush_cnt > 0)
+            {
+              lock_acquire (&d->lock);
+              for (i = 0; i < flush_cnt; i++)
+                release_block (d, flush[i]);
+              lock_release (&d->lock);
+            }
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          enum intr_level old_level = intr_disable ();
+          big_cnt--;
+          big_pages -= a->free_cnt;
+          intr_set_level (old_level);
+
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Removes and returns the most recently freed block in D's
+   magazine, or returns a null pointer if it is empty. */
+static struct block *
+mag_pop (struct desc *d)
+{
+  struct block *b = NULL;
+  enum intr_level old_level = intr_disable ();
+
+  if (d->mag_cnt > 0)
+    {
+      b = d->mag[--d->mag_cnt];
+      d->mag_hits++;
+    }
+  intr_set_level (old_level);
+  return b;
+}
+
+/* Adds B to D's magazine and returns true, or returns false if
+   the magazine is full. */
+static bool
+mag_push (struct desc *d, struct block *b)
+{
+  bool ok = false;
+  enum intr_level old_level = intr_disable ();
+
+  if (d->mag_cnt < MAG_SIZE)
+    {
+      d->mag[d->mag_cnt++] = b;
+      ok = true;
+    }
+  intr_set_level (old_level);
+  return ok;
+}
+
+/* Returns block B, which must not be in the magazine, to D's
+   free list, and gives its arena back to the page allocator if
+   the arena is now entirely unused.  D's lock must be held. */
+static void
+release_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena)
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+      d->arena_cnt--;
+    }
+}
+
+/* Empties every descriptor's magazine into its free list, giving
+   arenas that become entirely unused back to the page allocator,
+   and returns the number of pages freed.  Called by the page
+   allocator when it runs out of pages, which may happen while
+   the caller holds a descriptor's lock, so skips any descriptor
+   whose lock is not immediately available instead of waiting for
+   it.  Must not be called from an interrupt handler. */
+size_t
+malloc_reap (void)
+{
+  size_t freed = 0;
+  struct desc *d;
+
+  ASSERT (!intr_context ());
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (!lock_held_by_current_thread (&d->lock)
+        && lock_try_acquire (&d->lock))
+      {
+        struct block *flush[MAG_SIZE];
+        size_t arena_cnt = d->arena_cnt;
+        size_t flush_cnt, i;
+        enum intr_level old_level;
+
+        old_level = intr_disable ();
+        flush_cnt = d->mag_cnt;
+        memcpy (flush, d->mag, flush_cnt * sizeof *d->mag);
+        d->mag_cnt = 0;
+        intr_set_level (old_level);
+
+        for (i = 0; i < flush_cnt; i++)
+          release_block (d, flush[i]);
+        freed += arena_cnt - d->arena_cnt;
+        lock_release (&d->lock);
+      }
+  return freed;
+}
+
+/* Prints statistics about malloc(): the magazine hit rate, the
+   live blocks and arenas of each descriptor in use, the live big
+   blocks, and, if alloc_tracking is true, the call sites that
+   hold memory. */
+void
+malloc_print_stats (void)
+{
+  long long hits = 0, misses = 0;
+  enum intr_level old_level;
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    {
+      hits += d->mag_hits;
+      misses += d->mag_misses;
+    }
+  printf ("Malloc: %lld of %lld small allocations served from magazines\n",
+          hits, hits + misses);
+
+  old_level = intr_disable ();
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->arena_cnt > 0)
+      printf ("Malloc: %zu live %zu-byte blocks in %zu arenas\n",
+              (d->arena_cnt * d->blocks_per_arena
+               - list_size (&d->free_list) - d->mag_cnt),
+              d->block_size, d->arena_cnt);
+  printf ("Malloc: %zu live big blocks in %zu pages (peak %zu pages)\n",
+          big_cnt, big_pages, big_peak_pages);
+  intr_set_level (old_level);
+
+  if (alloc_tracking)
+    print_sites ();
+}
+
+/* Prints, for each call site that holds blocks allocated with
+   malloc(), calloc(), or realloc(), the number of blocks and
+   bytes it holds.  The addresses can be translated into
+   function names with the "backtrace" utility. */
+static void
+print_sites (void)
+{
+  struct site
+    {
+      void *caller;
+      size_t block_cnt;
+      size_t bytes;
+    };
+  static struct site sites[SITE_MAX];
+  size_t site_cnt = 0;
+  size_t other_cnt = 0, other_bytes = 0;
+  enum intr_level old_level;
+  struct list_elem *e;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&live_tags); e != list_end (&live_tags);
+       e = list_next (e))
+    {
+      struct alloc_tag *t = list_entry (e, struct alloc_tag, elem);
+
+      for (i = 0; i < site_cnt; i++)
+        if (sites[i].caller == t->caller)
+          break;
+      if (i < site_cnt)
+        {
+          sites[i].block_cnt++;
+          sites[i].bytes += t->size;
+        }
+      else if (site_cnt < SITE_MAX)
+        {
+          sites[site_cnt].caller = t->caller;
+          sites[site_cnt].block_cnt = 1;
+          sites[site_cnt++].bytes = t->size;
+        }
+      else
+        {
+          other_cnt++;
+          other_bytes += t->size;
+        }
+    }
+  intr_set_level (old_level);
+
+  for (i = 0; i < site_cnt; i++)
+    printf ("Malloc: %zu blocks, %zu bytes held by %p\n",
+            sites[i].block_cnt, sites[i].bytes, sites[i].caller);
+  if (other_cnt > 0)
+    printf ("Malloc: %zu blocks, %zu bytes held by other sites\n",
+            other_cnt, other_bytes);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
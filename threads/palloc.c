@@ -1,14 +1,16 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,14 +25,78 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept
+   in blocks of 2**ORDER pages, each aligned, relative to the
+   start of the pool, on a multiple of its own size, on one free
+   list per order.  An allocation takes the smallest free block
+   that is big enough, splitting larger blocks in half as needed,
+   and returns any pages beyond the requested number to the free
+   lists.  Freeing a block merges it with its "buddy", the other
+   half of the block it was split from, for as long as the buddy
+   is also free.  Both take O(log n) time in the size of the
+   pool.
+
+   Pages can be freed with interrupts off, by the scheduler
+   among others, so the pools are protected by disabling
+   interrupts rather than by locks.
+
+   Each pool also keeps a small stock of pages that are already
+   filled with zeros, which the idle thread tops up by calling
+   palloc_zero_refill().  Single-page PAL_ZERO allocations are
+   served from the stock first, so they do not have to clear a
+   page themselves.  The stock is given back to the buddy
+   allocator whenever an allocation would otherwise fail.  If
+   that is not enough for a kernel pool allocation, and the
+   caller can take locks, the object caches and malloc() are
+   asked to give back the pages they hold only for caching, with
+   kmem_cache_reap() and malloc_reap().
+
+   If alloc_tracking is true, each pool also records, for each
+   page in use, the address of the code that allocated it, so
+   that palloc_print_stats() can report which call sites hold
+   pages at shutdown. */
+
+/* Number of block orders.  The largest block is 2**(ORDER_CNT-1)
+   pages. */
+#define ORDER_CNT 16
+
+/* Value in free_order[] for a page that does not begin a free
+   block. */
+#define NOT_FREE 0xff
+
+/* Maximum number of pre-zeroed pages kept in each pool. */
+#define ZEROED_MAX 32
+
+/* Maximum number of distinct call sites in a usage report. */
+#define SITE_MAX 32
+
+/* If true, record the call site of each allocation, here and in
+   malloc().  Controlled by kernel command-line option
+   "-alloc-sites". */
+bool alloc_tracking;
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    const char *name;                   /* Name, for statistics. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks, by order. */
+    uint8_t *free_order;                /* Order of the free block
+                                           that begins at each
+                                           page, or NOT_FREE. */
+    bool *allocated;                    /* Whether each page has been
+                                           handed out and not yet
+                                           freed. */
+    void *zeroed[ZEROED_MAX];           /* Pre-zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pre-zeroed pages. */
+    unsigned long long zeroed_hits;     /* PAL_ZERO pages from stock. */
+    size_t peak_used;                   /* Most pages ever in use. */
+    void **sites;                       /* Allocating code of each page
+                                           in use, if alloc_tracking. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +105,18 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_block (struct pool *, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void free_block (struct pool *, size_t page_idx, int order);
+static int order_for (size_t page_cnt);
+static void release_zeroed (struct pool *);
+static void refill_zeroed (struct pool *);
+static void *get_multiple (enum palloc_flags, size_t page_cnt,
+                           void *caller);
+static void note_use (struct pool *, size_t page_idx, size_t page_cnt,
+                      void *caller);
+static void print_pool_stats (struct pool *);
+static void print_pool_sites (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -69,19 +147,90 @@ palloc_init (size_t user_page_limit)
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return get_multiple (flags, page_cnt, __builtin_return_address (0));
+}
+
+/* Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is obtained from the user pool,
+   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags)
+{
+  return get_multiple (flags, 1, __builtin_return_address (0));
+}
+
+/* Implements palloc_get_multiple(), on behalf of the code at
+   CALLER. */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt, void *caller)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
   void *pages;
   size_t page_idx;
+  int order;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* Take a page that is already zeroed, if we can. */
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+      pages = NULL;
+      old_level = intr_disable ();
+      if (pool->zeroed_cnt > 0)
+        {
+          pages = pool->zeroed[--pool->zeroed_cnt];
+          pool->zeroed_hits++;
+          note_use (pool, ((uint8_t *) pages - pool->base) / PGSIZE, 1,
+                    caller);
+        }
+      intr_set_level (old_level);
+      if (pages != NULL)
+        return pages;
+    }
+
+  order = order_for (page_cnt);
+  if (order < ORDER_CNT)
+    {
+      old_level = intr_disable ();
+      page_idx = alloc_block (pool, order);
+      if (page_idx == SIZE_MAX && pool->zeroed_cnt > 0)
+        {
+          release_zeroed (pool);
+          page_idx = alloc_block (pool, order);
+        }
+      if (page_idx == SIZE_MAX && pool == &kernel_pool
+          && old_level == INTR_ON && !intr_context ())
+        {
+          /* These take locks, so they need interrupts on.  The
+             pages they free may be taken by another thread before
+             we get them, but then we are no worse off. */
+          intr_set_level (old_level);
+          kmem_cache_reap ();
+          malloc_reap ();
+          intr_disable ();
+          page_idx = alloc_block (pool, order);
+        }
+      if (page_idx != SIZE_MAX)
+        {
+          /* Give back the pages beyond PAGE_CNT. */
+          pool->free_cnt -= (size_t) 1 << order;
+          free_range (pool, page_idx + page_cnt,
+                      ((size_t) 1 << order) - page_cnt);
+          note_use (pool, page_idx, page_cnt, caller);
+        }
+      intr_set_level (old_level);
+    }
+  else
+    page_idx = SIZE_MAX;
 
-  if (page_idx != BITMAP_ERROR)
+  if (page_idx != SIZE_MAX)
     pages = pool->base + PGSIZE * page_idx;
   else
     pages = NULL;
@@ -100,24 +249,12 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
-/* Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
-void *
-palloc_get_page (enum palloc_flags flags)
-{
-  return palloc_get_multiple (flags, 1);
-}
-
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -132,13 +269,22 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+
+  /* note_use() checks that the pages are allocated, so do it
+     first, before a bad free can damage the free lists or a
+     pre-zeroed page, either of which may live in these pages. */
+  old_level = intr_disable ();
+  note_use (pool, page_idx, page_cnt, NULL);
+  intr_set_level (old_level);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable ();
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +294,75 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Tops up each pool's stock of pre-zeroed pages from its free
+   pages.  Called by the idle thread, with interrupts off.
+   Interrupts are turned back on while each page is being
+   cleared, so that a thread that becomes ready can preempt the
+   caller, but they are off again on return. */
+void
+palloc_zero_refill (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  refill_zeroed (&kernel_pool);
+  refill_zeroed (&user_pool);
+}
+
+/* Prints statistics about both pools, followed by the call
+   sites that hold pages if alloc_tracking is true. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+  if (alloc_tracking)
+    {
+      print_pool_sites (&kernel_pool);
+      print_pool_sites (&user_pool);
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  /* We'll put the pool's free_order and allocated maps, and its
+     call site map if we need one, at its base.  Calculate the
+     space needed for the maps and subtract it from the pool's
+     size. */
+  size_t site_size = alloc_tracking ? sizeof *p->sites : 0;
+  size_t map_pages = DIV_ROUND_UP (page_cnt * (2 + site_size) + site_size,
+                                   PGSIZE);
+  int order;
+  if (map_pages > page_cnt)
+    PANIC ("Not enough memory in %s for free map.", name);
+  page_cnt -= map_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  p->base = (uint8_t *) base + map_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  p->free_order = base;
+  memset (p->free_order, NOT_FREE, page_cnt);
+  p->allocated = (bool *) (p->free_order + page_cnt);
+  memset (p->allocated, 0, page_cnt);
+  p->zeroed_cnt = 0;
+  p->zeroed_hits = 0;
+  p->peak_used = 0;
+  p->sites = NULL;
+  if (alloc_tracking)
+    {
+      p->sites = (void **) ROUND_UP ((uintptr_t) (p->allocated + page_cnt),
+                                     sizeof *p->sites);
+      memset (p->sites, 0, page_cnt * sizeof *p->sites);
+    }
+  free_range (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +372,254 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Removes a free block of 2**ORDER pages from POOL, splitting a
+   larger block if necessary, and returns the index of its first
+   page.  Returns SIZE_MAX if there is no block big enough.
+   Does not update POOL's free page count.  Interrupts must be
+   off. */
+static size_t
+alloc_block (struct pool *pool, int order)
+{
+  size_t page_idx;
+  int k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (k = order; k < ORDER_CNT; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k >= ORDER_CNT)
+    return SIZE_MAX;
+
+  page_idx = pg_no (list_pop_front (&pool->free_lists[k]))
+             - pg_no (pool->base);
+  pool->free_order[page_idx] = NOT_FREE;
+
+  /* Put the unused upper halves back on the free lists. */
+  while (k > order)
+    {
+      size_t buddy;
+
+      k--;
+      buddy = page_idx + ((size_t) 1 << k);
+      pool->free_order[buddy] = k;
+      list_push_front (&pool->free_lists[k],
+                       (struct list_elem *) (pool->base + PGSIZE * buddy));
+    }
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages in POOL starting at index PAGE_IDX,
+   which need not be a single block.  Interrupts must be off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  pool->free_cnt += page_cnt;
+  while (page_cnt > 0)
+    {
+      /* Free the largest aligned block that starts at PAGE_IDX
+         and fits in the range. */
+      int order = 0;
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Returns the block of 2**ORDER pages starting at index PAGE_IDX
+   to POOL, merging it with its buddy as long as the buddy is
+   free too.  Does not update POOL's free page count.
+   Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= pool->page_cnt || pool->free_order[buddy] != order)
+        break;
+
+      list_remove ((struct list_elem *) (pool->base + PGSIZE * buddy));
+      pool->free_order[buddy] = NOT_FREE;
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+
+  pool->free_order[page_idx] = order;
+  list_push_front (&pool->free_lists[order],
+                   (struct list_elem *) (pool->base + PGSIZE * page_idx));
+}
+
+/* Returns the order of the smallest block that holds PAGE_CNT
+   pages. */
+static int
+order_for (size_t page_cnt)
+{
+  int order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Returns all of POOL's pre-zeroed pages to its free lists.
+   Interrupts must be off. */
+static void
+release_zeroed (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (pool->zeroed_cnt > 0)
+    {
+      uint8_t *page = pool->zeroed[--pool->zeroed_cnt];
+      free_range (pool, (page - pool->base) / PGSIZE, 1);
+    }
+}
+
+/* Fills POOL's stock of pre-zeroed pages, for as long as it has
+   free pages.  Interrupts must be off, but they are enabled
+   while each page is cleared. */
+static void
+refill_zeroed (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (pool->zeroed_cnt < ZEROED_MAX)
+    {
+      uint8_t *page;
+      size_t page_idx = alloc_block (pool, 0);
+      if (page_idx == SIZE_MAX)
+        break;
+      pool->free_cnt--;
+
+      page = pool->base + PGSIZE * page_idx;
+      intr_enable ();
+      memset (page, 0, PGSIZE);
+      intr_disable ();
+
+      pool->zeroed[pool->zeroed_cnt++] = page;
+    }
+}
+
+/* Records that the PAGE_CNT pages in POOL starting at index
+   PAGE_IDX were just allocated by the code at CALLER, or are
+   about to be freed if CALLER is null.  Panics if a page being
+   freed is not allocated, which catches double frees and frees
+   of the wrong number of pages.  Interrupts must be off. */
+static void
+note_use (struct pool *pool, size_t page_idx, size_t page_cnt,
+          void *caller)
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (caller != NULL)
+    {
+      size_t used = pool->page_cnt - pool->free_cnt - pool->zeroed_cnt;
+      if (used > pool->peak_used)
+        pool->peak_used = used;
+    }
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    {
+      ASSERT (pool->allocated[i] == (caller == NULL));
+      pool->allocated[i] = caller != NULL;
+      if (pool->sites != NULL)
+        pool->sites[i] = caller;
+    }
+}
+
+/* Prints statistics about POOL: how many of its pages are in use
+   now and at most, the size of the largest free block, how
+   fragmented the free memory is, as the percentage of free pages
+   that are not in the largest free block, and how many PAL_ZERO
+   pages came from the pre-zeroed stock. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t free_cnt, zeroed_cnt, peak_used, largest = 0;
+  unsigned long long zeroed_hits;
+  int order;
+
+  old_level = intr_disable ();
+  free_cnt = pool->free_cnt;
+  zeroed_cnt = pool->zeroed_cnt;
+  zeroed_hits = pool->zeroed_hits;
+  peak_used = pool->peak_used;
+  for (order = ORDER_CNT - 1; order >= 0; order--)
+    if (!list_empty (&pool->free_lists[order]))
+      {
+        largest = (size_t) 1 << order;
+        break;
+      }
+  intr_set_level (old_level);
+
+  printf ("Palloc: %zu of %zu pages in use in %s (peak %zu), "
+          "largest free block %zu pages, %zu%% fragmented\n",
+          pool->page_cnt - free_cnt - zeroed_cnt, pool->page_cnt,
+          pool->name, peak_used, largest,
+          free_cnt > 0 ? 100 - largest * 100 / free_cnt : 0);
+  printf ("Palloc: %zu pre-zeroed pages in %s, "
+          "%llu zeroed allocations served from them\n",
+          zeroed_cnt, pool->name, zeroed_hits);
+}
+
+/* Prints, for each call site that holds pages in POOL, the
+   number of pages it holds.  The addresses can be translated
+   into function names with the "backtrace" utility. */
+static void
+print_pool_sites (struct pool *pool)
+{
+  struct site
+    {
+      void *caller;
+      size_t page_cnt;
+    };
+  static struct site sites[SITE_MAX];
+  size_t site_cnt = 0;
+  size_t other = 0;
+  enum intr_level old_level;
+  size_t i, j;
+
+  old_level = intr_disable ();
+  for (i = 0; i < pool->page_cnt; i++)
+    if (pool->sites[i] != NULL)
+      {
+        for (j = 0; j < site_cnt; j++)
+          if (sites[j].caller == pool->sites[i])
+            break;
+        if (j < site_cnt)
+          sites[j].page_cnt++;
+        else if (site_cnt < SITE_MAX)
+          {
+            sites[site_cnt].caller = pool->sites[i];
+            sites[site_cnt++].page_cnt = 1;
+          }
+        else
+          other++;
+      }
+  intr_set_level (old_level);
+
+  for (j = 0; j < site_cnt; j++)
+    printf ("Palloc: %zu pages in %s held by %p\n",
+            sites[j].page_cnt, pool->name, sites[j].caller);
+  if (other > 0)
+    printf ("Palloc: %zu pages in %s held by other sites\n",
+            other, pool->name);
+}
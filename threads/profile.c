@@ -0,0 +1,142 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   At each timer interrupt, profile_sample() records where the
+   CPU was: the interrupted instruction pointer and, for kernel
+   code, the return addresses of up to PROFILE_DEPTH - 1 callers,
+   found by following the chain of saved frame pointers.  Samples
+   go into a buffer allocated at startup.  Once it is full,
+   further samples are counted but dropped.
+
+   profile_dump() prints the samples in hexadecimal between
+   "PROFILE-BEGIN" and "PROFILE-END".  utils/pintos-prof turns
+   that into flat and call-graph profiles. */
+
+/* Number of pages in the sample buffer. */
+#define PROFILE_PAGES 64
+
+/* Maximum number of addresses in a sample. */
+#define PROFILE_DEPTH 8
+
+/* One sample: the interrupted instruction pointer, then return
+   addresses from innermost to outermost, padded with zeros. */
+struct profile_sample
+  {
+    uint32_t pc[PROFILE_DEPTH];
+  };
+
+/* Number of samples that fit in the buffer. */
+#define PROFILE_SAMPLE_CNT \
+  (PROFILE_PAGES * PGSIZE / sizeof (struct profile_sample))
+
+/* If true, sample the interrupted program counter at each timer
+   interrupt.  Controlled by kernel command-line option
+   "-profile". */
+bool profile_enabled;
+
+static struct profile_sample *samples;  /* Sample buffer, or NULL. */
+static size_t sample_cnt;               /* Number of samples taken. */
+static long long dropped_cnt;           /* Samples that did not fit. */
+
+/* Allocates the sample buffer, if profiling is enabled. */
+void
+profile_init (void)
+{
+  if (!profile_enabled)
+    return;
+
+  samples = palloc_get_multiple (0, PROFILE_PAGES);
+  if (samples == NULL)
+    printf ("profile: out of memory, profiling disabled\n");
+}
+
+/* Records a sample for the code interrupted with frame F.
+   Called by the timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  struct profile_sample *s;
+  int depth = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (samples == NULL)
+    return;
+  if (sample_cnt >= PROFILE_SAMPLE_CNT)
+    {
+      dropped_cnt++;
+      return;
+    }
+
+  s = &samples[sample_cnt++];
+  s->pc[depth++] = (uint32_t) f->eip;
+
+  /* Walk the interrupted kernel thread's frame pointers, but only
+     within its own stack, so that a clobbered or omitted frame
+     pointer cannot make us read outside of it.  User stacks are
+     not walked, since they may not be mapped. */
+  if ((f->cs & 3) == 0)
+    {
+      struct thread *t = thread_current ();
+      uint32_t *frame = (uint32_t *) f->ebp;
+      uint32_t *stack_bottom = (uint32_t *) thread_stack_bottom (t);
+      uint32_t *stack_top = (uint32_t *) thread_stack_top (t);
+
+      while (depth < PROFILE_DEPTH
+             && frame >= stack_bottom && frame + 2 <= stack_top
+             && (uintptr_t) frame % sizeof *frame == 0
+             && frame[1] != 0)
+        {
+          s->pc[depth++] = frame[1];
+          if ((uint32_t *) frame[0] <= frame)
+            break;
+          frame = (uint32_t *) frame[0];
+        }
+    }
+  while (depth < PROFILE_DEPTH)
+    s->pc[depth++] = 0;
+}
+
+/* Prints the samples to the console and empties the sample
+   buffer. */
+void
+profile_dump (void)
+{
+  enum intr_level old_level;
+  struct profile_sample *buf;
+  size_t cnt, i;
+  int j;
+
+  /* Stop sampling while we print. */
+  old_level = intr_disable ();
+  buf = samples;
+  cnt = sample_cnt;
+  samples = NULL;
+  intr_set_level (old_level);
+  if (buf == NULL)
+    return;
+
+  printf ("PROFILE-BEGIN %zu samples, %lld dropped\n", cnt, dropped_cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      printf ("PROFILE");
+      for (j = 0; j < PROFILE_DEPTH && buf[i].pc[j] != 0; j++)
+        printf (" %08"PRIx32, buf[i].pc[j]);
+      printf ("\n");
+    }
+  printf ("PROFILE-END\n");
+
+  old_level = intr_disable ();
+  sample_cnt = 0;
+  dropped_cnt = 0;
+  samples = buf;
+  intr_set_level (old_level);
+}
@@ -0,0 +1,342 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   An object cache hands out objects of a single type.  Unlike
+   malloc(), which rounds every request up to a power of 2, it
+   packs objects of exactly the requested size and alignment into
+   page-size "slabs", so that, for example, 7 inodes of a little
+   over 512 bytes fit in a page instead of 3.
+
+   Each slab begins with a header, followed by its objects.  The
+   link that chains a free object into its slab's free list is
+   kept in a word just past the object, not inside it, so that
+   an object keeps whatever its constructor, if any, put in it.
+   The constructor runs once for each object, when its slab is
+   created, not each time the object is allocated, so an object
+   must be in its constructed state again when it is freed.
+
+   A cache keeps its slabs on three lists: slabs that are full,
+   slabs with some free objects, which are allocated from first,
+   and slabs that are entirely free.  One entirely free slab is
+   kept around to absorb alternating allocations and frees;
+   further ones go back to the page allocator right away, and
+   kmem_cache_shrink() releases that one as well.  When the page
+   allocator runs out of kernel pages, it calls kmem_cache_reap()
+   to do the same for every cache before giving up. */
+
+/* Maximum number of caches.  Caches are never destroyed. */
+#define KMEM_CACHE_MAX 16
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* An object cache. */
+struct kmem_cache
+  {
+    char name[16];              /* Name, for statistics. */
+    size_t size;                /* Object size in bytes. */
+    size_t stride;              /* Object size plus link, aligned. */
+    size_t first_ofs;           /* Offset of first object in a slab. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct lock lock;           /* Protects members below. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list empty;          /* Slabs with only free objects. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Number of allocated objects. */
+    long long allocs;           /* Number of allocations. */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of cache's lists. */
+    size_t in_use;              /* Number of allocated objects. */
+    void *free;                 /* First free object, or null. */
+  };
+
+static struct kmem_cache caches[KMEM_CACHE_MAX];
+static int cache_cnt;
+
+static struct slab *new_slab (struct kmem_cache *);
+static size_t free_empty_slabs (struct kmem_cache *);
+static struct slab *object_to_slab (struct kmem_cache *, void *);
+static void **object_link (struct kmem_cache *, void *);
+
+/* Creates and returns a cache, named NAME, of objects of SIZE
+   bytes each, aligned on a multiple of ALIGN bytes, which must
+   be a power of 2, or 0 for the default of the size of a
+   pointer.  If CTOR is nonnull, it is called on each object
+   when the object is first added to the cache.  Panics if too
+   many caches have been created or if a slab would not hold even
+   one object. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  if (align < sizeof (void *))
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+  ASSERT (size > 0);
+
+  if (cache_cnt >= KMEM_CACHE_MAX)
+    PANIC ("too many object caches creating \"%s\"", name);
+  c = &caches[cache_cnt];
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->size = size;
+  c->stride = ROUND_UP (ROUND_UP (size, sizeof (void *)) + sizeof (void *),
+                        align);
+  c->first_ofs = ROUND_UP (sizeof (struct slab), align);
+  if (c->first_ofs + c->stride > PGSIZE)
+    PANIC ("object cache \"%s\": %zu-byte objects do not fit in a slab",
+           name, size);
+  c->objs_per_slab = (PGSIZE - c->first_ofs) / c->stride;
+  c->ctor = ctor;
+  lock_init_named (&c->lock, name);
+  list_init (&c->full);
+  list_init (&c->partial);
+  list_init (&c->empty);
+  c->slab_cnt = 0;
+  c->in_use = 0;
+  c->allocs = 0;
+
+  /* Publish the cache only once it is initialized, since
+     kmem_cache_reap() may look at it at any time. */
+  barrier ();
+  cache_cnt++;
+  return c;
+}
+
+/* Allocates and returns an object from cache C, or a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Find a slab with a free object, creating one if needed. */
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = new_slab (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take the object. */
+  obj = s->free;
+  s->free = *object_link (c, obj);
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+  c->in_use++;
+  c->allocs++;
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C and
+   must be in its constructed state, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = object_to_slab (c, obj);
+  lock_acquire (&c->lock);
+
+  ASSERT (s->in_use > 0);
+  *object_link (c, obj) = s->free;
+  s->free = obj;
+  c->in_use--;
+  if (s->in_use-- == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->in_use == 0)
+    {
+      list_remove (&s->elem);
+      if (list_empty (&c->empty))
+        list_push_front (&c->empty, &s->elem);
+      else
+        {
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Gives the slabs in cache C that have no allocated objects
+   back to the page allocator.  Returns the number of pages
+   freed. */
+size_t
+kmem_cache_shrink (struct kmem_cache *c)
+{
+  size_t freed;
+
+  lock_acquire (&c->lock);
+  freed = free_empty_slabs (c);
+  lock_release (&c->lock);
+
+  return freed;
+}
+
+/* Shrinks every cache, as kmem_cache_shrink() does, and returns
+   the total number of pages freed.  Called by the page allocator
+   when it runs out of pages, which may happen while the caller
+   holds a cache's lock, so skips any cache whose lock is not
+   immediately available instead of waiting for it.  Must not be
+   called from an interrupt handler. */
+size_t
+kmem_cache_reap (void)
+{
+  size_t freed = 0;
+  int i;
+
+  ASSERT (!intr_context ());
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+
+      if (!lock_held_by_current_thread (&c->lock)
+          && lock_try_acquire (&c->lock))
+        {
+          freed += free_empty_slabs (c);
+          lock_release (&c->lock);
+        }
+    }
+  return freed;
+}
+
+/* Prints statistics about each object cache. */
+void
+kmem_cache_print_stats (void)
+{
+  int i;
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      size_t capacity = c->slab_cnt * c->objs_per_slab;
+
+      printf ("Cache %s: %zu of %zu %zu-byte objects in use "
+              "in %zu slabs, %lld allocations\n",
+              c->name, c->in_use, capacity, c->size, c->slab_cnt,
+              c->allocs);
+    }
+}
+
+/* Allocates a new slab for cache C, constructs its objects, and
+   returns it, or returns a null pointer if no page is
+   available.  C's lock must be held. */
+static struct slab *
+new_slab (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + c->first_ofs + i * c->stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *object_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Gives the slabs in cache C that have no allocated objects
+   back to the page allocator and returns how many there were.
+   C's lock must be held. */
+static size_t
+free_empty_slabs (struct kmem_cache *c)
+{
+  size_t freed = 0;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  while (!list_empty (&c->empty))
+    {
+      struct slab *s = list_entry (list_pop_front (&c->empty),
+                                   struct slab, elem);
+      s->magic = 0;
+      palloc_free_page (s);
+      freed++;
+    }
+  c->slab_cnt -= freed;
+  return freed;
+}
+
+/* Returns the slab that contains OBJ, which must be an object in
+   cache C. */
+static struct slab *
+object_to_slab (struct kmem_cache *c UNUSED, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((pg_ofs (obj) - c->first_ofs) % c->stride == 0);
+  return s;
+}
+
+/* Returns the address of the free-list link for OBJ, an object
+   in cache C. */
+static void **
+object_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->stride - sizeof (void *));
+}
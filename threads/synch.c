@@ -27,10 +27,60 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "devices/timer.h"
+
+/* Maximum depth of a chain of nested priority donations, that
+   is, the number of locks followed from a waiting thread to the
+   holder of the lock at the end of the chain. */
+#define DONATION_DEPTH_MAX 8
+
+/* Lock contention profiling.
+
+   A lock initialized with lock_init_named() while lock_profiling
+   is true gets a lock_profile, which counts its acquisitions and
+   measures how long threads waited for it and held it.  Profiles
+   are never freed, so only locks that live until shutdown should
+   be named. */
+#define LOCK_PROFILE_MAX 32     /* Maximum number of profiled locks. */
+#define LOCK_TOP_WAITERS 4      /* Waiters tracked per profiled lock. */
+
+/* Contention statistics for one lock. */
+struct lock_profile
+  {
+    char name[16];              /* Name, for the report. */
+    long long acquires;         /* # of acquisitions. */
+    long long contended;        /* # that had to wait. */
+    uint64_t wait_ns;           /* Total time spent waiting. */
+    uint64_t max_wait_ns;       /* Longest single wait. */
+    uint64_t hold_ns;           /* Total time held. */
+    uint64_t acquired_at;       /* When the current holder got it. */
+
+    /* Threads that waited most often.  An approximation: once the
+       table is full, a new waiter replaces the least frequent
+       one, inheriting its count. */
+    struct
+      {
+        tid_t tid;
+        long long cnt;
+      }
+    waiters[LOCK_TOP_WAITERS];
+  };
+
+bool lock_profiling;
+static struct lock_profile lock_profiles[LOCK_PROFILE_MAX];
+static int lock_profile_cnt;
+
+static void lock_donate (struct lock *, int priority);
+static void lock_take (struct lock *);
+static void lock_profile_wait (struct lock_profile *, uint64_t start);
+static list_less_func thread_priority_less;
+static list_less_func semaphore_elem_priority_less;
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -102,7 +152,12 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Among waiters of equal priority, the one that
+   has waited longest is woken.  If the woken thread has a higher
+   priority than the running thread, yields to it: immediately if
+   interrupts were on, otherwise on return from the interrupt if
+   called from an interrupt handler.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +169,29 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters))
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+
+  if (old_level == INTR_ON && !intr_context ())
+    thread_preempt ();
+}
+
+/* Returns true if thread A has lower priority than thread B,
+   when both are in a semaphore's list of waiters. */
+static bool
+thread_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
 }
 
 static void sema_test_helper (void *sema_);
@@ -179,12 +253,36 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN - 1;
+  lock->profile = NULL;
+}
+
+/* Initializes LOCK, like lock_init(), and gives it NAME for the
+   contention report printed by lock_print_stats().  The lock
+   must not be destroyed before shutdown. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  lock_init (lock);
+  if (lock_profiling && lock_profile_cnt < LOCK_PROFILE_MAX)
+    {
+      struct lock_profile *p = &lock_profiles[lock_profile_cnt++];
+      strlcpy (p->name, name, sizeof p->name);
+      lock->profile = p;
+    }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   If the lock is held by a lower-priority thread, the current
+   thread donates its priority to the holder, and transitively
+   to the holder of any lock that the holder is itself waiting
+   for, so that the holder cannot be starved by medium-priority
+   threads while we wait.  Donation is disabled under the
+   multi-level feedback queue scheduler.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +290,33 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  old_level = intr_disable ();
+  if (lock->holder != NULL)
+    {
+      uint64_t start = lock->profile != NULL ? timer_now_ns () : 0;
+
+      trace_record (TRACE_LOCK, cur, lock->holder, 0);
+      if (!thread_mlfqs)
+        {
+          cur->wait_lock = lock;
+          lock_donate (lock, cur->priority);
+        }
+      sema_down (&lock->semaphore);
+      cur->wait_lock = NULL;
+      if (lock->profile != NULL)
+        lock_profile_wait (lock->profile, start);
+    }
+  else
+    sema_down (&lock->semaphore);
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,14 +328,17 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_take (lock);
+  intr_set_level (old_level);
   return success;
 }
 
@@ -228,11 +350,27 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  if (lock->profile != NULL)
+    lock->profile->hold_ns += timer_now_ns () - lock->profile->acquired_at;
+  if (!thread_mlfqs)
+    {
+      /* Give up the priority donated through LOCK. */
+      list_remove (&lock->elem);
+      thread_update_priority (cur);
+    }
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+
+  if (old_level == INTR_ON)
+    thread_preempt ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -245,12 +383,133 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
+
+/* Prints contention statistics for each profiled lock. */
+void
+lock_print_stats (void)
+{
+  int i, j;
+
+  for (i = 0; i < lock_profile_cnt; i++)
+    {
+      const struct lock_profile *p = &lock_profiles[i];
+
+      printf ("Lock %s: %lld acquires, %lld contended, "
+              "%"PRIu64" us waited (max %"PRIu64"), %"PRIu64" us held",
+              p->name, p->acquires, p->contended, p->wait_ns / 1000,
+              p->max_wait_ns / 1000, p->hold_ns / 1000);
+      for (j = 0; j < LOCK_TOP_WAITERS && p->waiters[j].cnt > 0; j++)
+        printf ("%s tid %d (%lld)", j == 0 ? ", top waiters:" : "",
+                p->waiters[j].tid, p->waiters[j].cnt);
+      printf ("\n");
+    }
+}
+
+/* Records in P that the current thread finished waiting for its
+   lock, having started at time START.  Interrupts must be off. */
+static void
+lock_profile_wait (struct lock_profile *p, uint64_t start)
+{
+  uint64_t wait = timer_now_ns () - start;
+  tid_t tid = thread_tid ();
+  int i, min;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  p->contended++;
+  p->wait_ns += wait;
+  if (wait > p->max_wait_ns)
+    p->max_wait_ns = wait;
+
+  /* Count TID as a waiter, replacing the least frequent waiter if
+     TID is not already in the table, then keep the table sorted
+     by decreasing count. */
+  min = 0;
+  for (i = 0; i < LOCK_TOP_WAITERS; i++)
+    {
+      if (p->waiters[i].cnt > 0 && p->waiters[i].tid == tid)
+        break;
+      if (p->waiters[i].cnt < p->waiters[min].cnt)
+        min = i;
+    }
+  if (i == LOCK_TOP_WAITERS)
+    {
+      i = min;
+      p->waiters[i].tid = tid;
+    }
+  p->waiters[i].cnt++;
+  for (; i > 0 && p->waiters[i].cnt > p->waiters[i - 1].cnt; i--)
+    {
+      tid_t t = p->waiters[i].tid;
+      long long cnt = p->waiters[i].cnt;
+      p->waiters[i] = p->waiters[i - 1];
+      p->waiters[i - 1].tid = t;
+      p->waiters[i - 1].cnt = cnt;
+    }
+}
+
+/* Donates PRIORITY to the holder of LOCK, and from there along
+   the chain of locks that each successive holder is waiting
+   for, stopping early once a holder already has at least
+   PRIORITY.  Interrupts must be off. */
+static void
+lock_donate (struct lock *lock, int priority)
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL || lock->max_priority >= priority)
+        break;
+      lock->max_priority = priority;
+      thread_update_priority (holder);
+      lock = holder->wait_lock;
+    }
+}
+
+/* Makes the current thread the holder of LOCK, whose semaphore
+   it has just downed.  The waiters that remain on LOCK carry
+   their donations over to the new holder.  Interrupts must be
+   off. */
+static void
+lock_take (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct list *waiters = &lock->semaphore.waiters;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+  if (lock->profile != NULL)
+    {
+      lock->profile->acquires++;
+      lock->profile->acquired_at = timer_now_ns ();
+    }
+  if (thread_mlfqs)
+    return;
+
+  lock->max_priority = PRI_MIN - 1;
+  for (e = list_begin (waiters); e != list_end (waiters); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (t->priority > lock->max_priority)
+        lock->max_priority = t->priority;
+    }
+  list_push_back (&cur->locks, &lock->elem);
+  thread_update_priority (cur);
+}
 
 /* One semaphore in a list. */
 struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -295,6 +554,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
 
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,8 +562,9 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the highest-priority one to wake up from
+   its wait, preferring the longest waiter among equals.  LOCK
+   must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -317,8 +578,24 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters))
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      semaphore_elem_priority_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A has
+   lower priority than the one waiting on semaphore_elem B. */
+static bool
+semaphore_elem_priority_less (const struct list_elem *a_,
+                              const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -336,3 +613,156 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as a readers-writer lock.  Any number of
+   readers may hold RW at once, or a single writer, but not both.
+
+   A writer holds RW's internal lock for as long as it writes.  A
+   reader holds that lock only long enough to register itself, so
+   a reader that arrives while a writer holds or is waiting for RW
+   waits behind the writer.  This prefers writers, so that a steady
+   stream of readers cannot starve them.  Because readers and
+   writers wait on an ordinary lock, a high-priority thread
+   waiting for RW donates its priority to the writer that holds or
+   waits for it.  Priority is not donated to readers, since there
+   can be many of them; they are expected to hold RW only
+   briefly. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  rw->readers = 0;
+  rw->writer_waiting = false;
+  sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or
+   waits for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  rw->readers++;
+  intr_set_level (old_level);
+  lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for reading and returns true if successful
+   or false on failure, that is, if a writer holds or waits for
+   RW or another reader is in the middle of acquiring it.
+
+   This function will not sleep, so it may be called within an
+   interrupt handler. */
+bool
+rwlock_try_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rw->lock.holder == NULL;
+  if (success)
+    rw->readers++;
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   If this is the last reader and a writer is waiting, wakes the
+   writer. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  if (--rw->readers == 0 && rw->writer_waiting)
+    {
+      rw->writer_waiting = false;
+      sema_up (&rw->drained);
+    }
+  intr_set_level (old_level);
+
+  if (old_level == INTR_ON && !intr_context ())
+    thread_preempt ();
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it for reading or writing.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  /* Holding the lock keeps new readers out, so once the current
+     readers leave, they stay gone. */
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  if (rw->readers > 0)
+    {
+      rw->writer_waiting = true;
+      sema_down (&rw->drained);
+    }
+  intr_set_level (old_level);
+}
+
+/* Tries to acquire RW for writing and returns true if successful
+   or false on failure, that is, if any other thread holds RW.
+
+   This function will not sleep. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rw->readers == 0 && lock_try_acquire (&rw->lock);
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  (Readers are not tracked individually, so there is
+   no way to tell whether the current thread holds RW for
+   reading.) */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->lock);
+}
@@ -20,15 +20,25 @@ void sema_self_test (void);
 /* Lock. */
 struct lock
   {
-    struct thread *holder;      /* Thread holding lock (for debugging). */
+    struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's `locks' list. */
+    int max_priority;           /* Priority donated by waiters. */
+    struct lock_profile *profile; /* Contention statistics, if any. */
   };
 
+/* If true, collect contention statistics for locks initialized
+   with lock_init_named().  Controlled by kernel command-line
+   option "-lockstat". */
+extern bool lock_profiling;
+
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
 
 /* Condition variable. */
 struct condition
@@ -41,6 +51,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by writers, briefly by readers. */
+    unsigned readers;           /* # of readers holding the lock. */
+    bool writer_waiting;        /* Is the lock's holder waiting for readers? */
+    struct semaphore drained;   /* Upped when the last reader leaves. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -1,16 +1,24 @@
 #include "threads/thread.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#ifdef STACK_GUARD
+#include <bitmap.h>
+#include "threads/init.h"
+#include "threads/pte.h"
+#endif
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +28,18 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority level.  Bit P of
+   ready_mask is set if and only if ready_queues[P] is nonempty,
+   so the highest-priority ready thread can be found without
+   scanning any list. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_mask;
+static int ready_cnt;           /* # of threads in all the run queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -49,6 +66,48 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long switch_cnt;    /* # of context switches. */
+static uint64_t switch_ns;      /* Total time spent switching, in ns. */
+static uint64_t switch_start;   /* When the current switch started. */
+
+/* Per-thread accounting totals, summed over threads. */
+struct thread_totals
+  {
+    int thread_cnt;             /* # of threads summed. */
+    long long vol_switches;     /* Blocks and exits. */
+    long long invol_switches;   /* Preemptions. */
+    long long dispatches;       /* Times a thread was scheduled. */
+    uint64_t ready_ns;          /* Time spent ready but not running. */
+    uint64_t blocked_ns;        /* Time spent blocked. */
+  };
+
+/* Totals for threads that have already exited. */
+static struct thread_totals exited_totals;
+
+/* Cache of the pages of threads that have exited, for reuse by
+   thread_create().  A cached page goes back to palloc only when
+   the cache is full.  Protected by disabling interrupts, because
+   pages are added to it in the middle of a thread switch. */
+#define THREAD_CACHE_MAX 8      /* Maximum # of pages cached. */
+static struct thread *thread_cache[THREAD_CACHE_MAX];
+static int thread_cache_cnt;
+
+#ifdef STACK_GUARD
+/* Slots of kernel virtual memory for thread pages and stacks,
+   all mapped by a single page table so that page directories
+   created after stack_slots_init() share it.  See the comment on
+   STACK_GUARD in thread.h. */
+#define THREAD_SLOT_SIZE (THREAD_SLOT_PAGES * PGSIZE)
+#define STACK_SLOTS_BASE ((uint8_t *) 0xf0000000)
+#define STACK_SLOT_CNT (PGSIZE / sizeof (uint32_t) / THREAD_SLOT_PAGES)
+#define STACK_SLOTS_END (STACK_SLOTS_BASE + STACK_SLOT_CNT * THREAD_SLOT_SIZE)
+#define STACK_GUARD_PAGE 1      /* Index of the guard page in a slot. */
+static uint32_t *stack_slots_pt; /* Page table for the slots. */
+static struct bitmap *stack_slots; /* Slots in use. */
+
+static void stack_slots_init (void);
+static void stack_slot_free (struct thread *);
+#endif
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -59,14 +118,42 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, print each thread's accounting statistics when it
+   exits.  Controlled by kernel command-line option
+   "-thread-stats". */
+bool thread_stats;
+
+/* Multi-level feedback queue scheduler.
+
+   Every thread's recent_cpu value decays once per second, and
+   the running thread's recent_cpu increases by one at each
+   tick.  A thread's priority depends only on its nice and
+   recent_cpu values, so between once-a-second updates only
+   threads that actually ran can have a new priority.  Those
+   threads are kept on changed_list, and only they have their
+   priorities recalculated every MLFQS_PRI_TICKS ticks. */
+#define MLFQS_PRI_TICKS 4       /* # of ticks between priority updates. */
+static fixed_t load_avg;        /* System load average. */
+static struct list changed_list; /* Threads whose recent_cpu changed. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_update_recent_cpu (struct thread *, void *coeff);
+static void print_thread_totals (void);
+static void add_thread_totals (struct thread *, void *totals);
+static int ready_max_priority (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *thread_page_alloc (void);
+static void thread_page_free (struct thread *);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
@@ -87,17 +174,24 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_init_named (&tid_lock, "tid");
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
   list_init (&all_list);
+  list_init (&changed_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  if (thread_mlfqs)
+    mlfqs_update_priority (initial_thread);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -107,6 +201,9 @@ thread_start (void)
 {
   /* Create the idle thread. */
   struct semaphore idle_started;
+#ifdef STACK_GUARD
+  stack_slots_init ();
+#endif
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
 
@@ -125,6 +222,7 @@ thread_tick (void)
   struct thread *t = thread_current ();
 
   /* Update statistics. */
+  t->cpu_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -134,9 +232,15 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
-    intr_yield_on_return ();
+    {
+      trace_record (TRACE_PREEMPT, t, NULL, TRACE_PREEMPT_SLICE);
+      intr_yield_on_return ();
+    }
 }
 
 /* Prints thread statistics. */
@@ -145,6 +249,50 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (switch_cnt > 0)
+    printf ("Thread: %lld context switches, %"PRIu64" ns average switch time\n",
+            switch_cnt, switch_ns / switch_cnt);
+  print_thread_totals ();
+}
+
+/* Prints per-thread accounting statistics, summed over all
+   threads that have run, excluding the idle thread. */
+static void
+print_thread_totals (void)
+{
+  struct thread_totals totals;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  totals = exited_totals;
+  thread_foreach (add_thread_totals, &totals);
+  intr_set_level (old_level);
+
+  printf ("Thread: %d threads, %lld voluntary and %lld involuntary switches\n",
+          totals.thread_cnt, totals.vol_switches, totals.invol_switches);
+  if (totals.dispatches > 0)
+    printf ("Thread: %"PRIu64" us average run queue latency, "
+            "%"PRIu64" us total blocked\n",
+            totals.ready_ns / totals.dispatches / 1000,
+            totals.blocked_ns / 1000);
+}
+
+/* Adds thread T's accounting statistics to *TOTALS_, unless T is
+   the idle thread, whose time waiting is not a cost.  Thread
+   action function used by print_thread_totals(). */
+static void
+add_thread_totals (struct thread *t, void *totals_)
+{
+  struct thread_totals *totals = totals_;
+
+  if (t == idle_thread)
+    return;
+  totals->thread_cnt++;
+  totals->vol_switches += t->vol_switches;
+  totals->invol_switches += t->invol_switches;
+  totals->dispatches += t->dispatches;
+  totals->ready_ns += t->ready_ns;
+  totals->blocked_ns += t->blocked_ns;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -157,11 +305,9 @@ thread_print_stats (void)
    before thread_create() returns.  Contrariwise, the original
    thread may run for any amount of time before the new thread is
    scheduled.  Use a semaphore or some other form of
-   synchronization if you need to ensure ordering.
-
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   synchronization if you need to ensure ordering.  In
+   particular, if PRIORITY is higher than the running thread's
+   priority, the new thread preempts the caller immediately. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -175,13 +321,24 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_alloc ();
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  Under the multi-level feedback queue
+     scheduler, the new thread inherits its parent's nice and
+     recent_cpu values, which determine its priority. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  if (thread_mlfqs)
+    {
+      struct thread *cur = thread_current ();
+      enum intr_level old_level = intr_disable ();
+      t->nice = cur->nice;
+      t->recent_cpu = cur->recent_cpu;
+      mlfqs_update_priority (t);
+      intr_set_level (old_level);
+    }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -216,6 +373,7 @@ thread_block (void)
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  trace_record (TRACE_BLOCK, thread_current (), NULL, 0);
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
@@ -224,21 +382,42 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, T
+   preempts it: immediately if the caller had interrupts enabled,
+   or on return from the interrupt if called from an interrupt
+   handler.  If the caller had disabled interrupts itself, this
+   function does not preempt the running thread, because the
+   caller may expect that it can atomically unblock a thread and
+   update other data.  Such callers should use thread_preempt()
+   once they are done. */
 void
 thread_unblock (struct thread *t)
 {
   enum intr_level old_level;
+  uint64_t now;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
+  now = timer_now_ns ();
+  t->blocked_ns += now - t->state_ns;
+  t->state_ns = now;
+  trace_record (TRACE_UNBLOCK, t, intr_context () ? NULL : running_thread (),
+                0);
+  if (intr_context ())
+    {
+      struct thread *cur = running_thread ();
+      if (t->priority > cur->priority)
+        {
+          trace_record (TRACE_PREEMPT, cur, t, TRACE_PREEMPT_PRIORITY);
+          intr_yield_on_return ();
+        }
+    }
+  else if (old_level == INTR_ON)
+    thread_preempt ();
   intr_set_level (old_level);
 }
 
@@ -286,11 +465,24 @@ thread_exit (void)
   process_exit ();
 #endif
 
+  if (thread_stats)
+    {
+      struct thread *cur = thread_current ();
+      printf ("%s: %lld ticks, %lld voluntary and %lld involuntary switches, "
+              "%"PRIu64" us ready, %"PRIu64" us blocked\n",
+              cur->name, cur->cpu_ticks, cur->vol_switches,
+              cur->invol_switches, cur->ready_ns / 1000,
+              cur->blocked_ns / 1000);
+    }
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  add_thread_totals (thread_current (), &exited_totals);
+  if (thread_current ()->recent_cpu_changed)
+    list_remove (&thread_current ()->changedelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -308,12 +500,32 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  Must not be called within an interrupt
+   handler; use intr_yield_on_return() there instead. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (ready_max_priority () > thread_current ()->priority)
+    {
+      trace_record (TRACE_PREEMPT, thread_current (), NULL,
+                    TRACE_PREEMPT_PRIORITY);
+      thread_yield ();
+    }
+  intr_set_level (old_level);
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -331,11 +543,66 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.
+   Priority donated to the thread through the locks it holds
+   stays in effect until those locks are released.  Yields if the
+   running thread no longer has the highest priority.
+
+   The multi-level feedback queue scheduler computes priorities
+   itself, so this function does nothing when it is in use. */
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Recomputes T's effective priority as the maximum of its base
+   priority and the priorities donated to it by the waiters of
+   each lock it holds (see lock_acquire() in synch.c).  If T is
+   ready, moves it to the run queue for its new priority.
+
+   Interrupts must be off.  This function does not preempt the
+   running thread; the caller should do so if appropriate. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->locks); e != list_end (&t->locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->max_priority > priority)
+        priority = lock->max_priority;
+    }
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -345,35 +612,153 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recalculates
+   its priority.  Yields if the running thread no longer has the
+   highest priority. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fix_round (fix_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fix_round (fix_mul_int (thread_current ()->recent_cpu,
+                                               100));
+  intr_set_level (old_level);
+  return recent_cpu_100;
+}
+
+/* Multi-level feedback queue scheduler work for a timer tick
+   while CUR is running.  Called from thread_tick(), in an
+   external interrupt context. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = fix_add_int (cur->recent_cpu, 1);
+      if (!cur->recent_cpu_changed)
+        {
+          cur->recent_cpu_changed = true;
+          list_push_back (&changed_list, &cur->changedelem);
+        }
+    }
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      /* Once per second, update the load average and then decay
+         every thread's recent_cpu.  This changes every thread's
+         priority, so all of them are recalculated.
+           load_avg = (59/60)*load_avg + (1/60)*ready_threads
+           recent_cpu = (2*load_avg)/(2*load_avg + 1)*recent_cpu + nice */
+      int ready_threads = ready_cnt + (cur != idle_thread);
+      fixed_t coeff;
+
+      load_avg = fix_add (fix_div_int (fix_mul_int (load_avg, 59), 60),
+                          fix_div_int (fix_int (ready_threads), 60));
+      coeff = fix_div (fix_mul_int (load_avg, 2),
+                       fix_add_int (fix_mul_int (load_avg, 2), 1));
+      thread_foreach (mlfqs_update_recent_cpu, &coeff);
+    }
+  else if (ticks % MLFQS_PRI_TICKS == 0)
+    {
+      /* Otherwise, recalculate the priority of only those
+         threads whose recent_cpu changed since last time. */
+      while (!list_empty (&changed_list))
+        {
+          struct list_elem *e = list_pop_front (&changed_list);
+          struct thread *t = list_entry (e, struct thread, changedelem);
+          t->recent_cpu_changed = false;
+          mlfqs_update_priority (t);
+        }
+    }
+  else
+    return;
+
+  if (ready_max_priority () > cur->priority)
+    {
+      trace_record (TRACE_PREEMPT, cur, NULL, TRACE_PREEMPT_PRIORITY);
+      intr_yield_on_return ();
+    }
+}
+
+/* Decays thread T's recent_cpu by the fixed-point coefficient
+   *COEFF_, then recalculates its priority.  Thread action
+   function used by mlfqs_tick(). */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *coeff_)
+{
+  const fixed_t *coeff = coeff_;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fix_add_int (fix_mul (*coeff, t->recent_cpu), t->nice);
+  if (t->recent_cpu_changed)
+    {
+      t->recent_cpu_changed = false;
+      list_remove (&t->changedelem);
+    }
+  mlfqs_update_priority (t);
+}
+
+/* Recalculates thread T's priority from its recent_cpu and nice
+   values:
+     priority = PRI_MAX - (recent_cpu / 4) - (nice * 2)
+   clamped to the range PRI_MIN...PRI_MAX.  If T is ready, moves
+   it to the run queue for its new priority.  Interrupts must be
+   off. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  int priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == idle_thread)
+    return;
+  priority = PRI_MAX - fix_trunc (fix_div_int (t->recent_cpu, 4))
+             - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+
+  t->base_priority = priority;
+  thread_update_priority (t);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -398,6 +783,22 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else wants to run, so clear some free pages
+         ahead of time for PAL_ZERO allocations. */
+      palloc_zero_refill ();
+
+      /* The refill runs with interrupts on while it clears each
+         page, so a thread may have become ready meanwhile
+         without preempting us, if its priority is no higher
+         than ours.  Interrupts are off again, so this check is
+         reliable: if one did, go run it instead of halting. */
+      if (ready_cnt > 0)
+        continue;
+
+      /* Nothing else can run, so let the timer skip the ticks
+         until the next thread needs to wake up. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -436,9 +837,37 @@ running_thread (void)
      always at the beginning of a page and the stack pointer is
      somewhere in the middle, this locates the curent thread. */
   asm ("mov %%esp, %0" : "=g" (esp));
+#ifdef STACK_GUARD
+  /* A thread in a stack slot is at the start of the slot. */
+  if ((uint8_t *) esp >= STACK_SLOTS_BASE && (uint8_t *) esp < STACK_SLOTS_END)
+    return (struct thread *) ((uintptr_t) esp & ~(THREAD_SLOT_SIZE - 1));
+#endif
   return pg_round_down (esp);
 }
 
+/* Returns the address just past the top of T's kernel stack. */
+uint8_t *
+thread_stack_top (struct thread *t)
+{
+#ifdef STACK_GUARD
+  if ((uint8_t *) t >= STACK_SLOTS_BASE && (uint8_t *) t < STACK_SLOTS_END)
+    return (uint8_t *) t + THREAD_SLOT_SIZE;
+#endif
+  return (uint8_t *) t + PGSIZE;
+}
+
+/* Returns the lowest address of T's kernel stack that is mapped
+   and not part of T's struct thread. */
+uint8_t *
+thread_stack_bottom (struct thread *t)
+{
+#ifdef STACK_GUARD
+  if ((uint8_t *) t >= STACK_SLOTS_BASE && (uint8_t *) t < STACK_SLOTS_END)
+    return thread_stack_top (t) - THREAD_STACK_PAGES * PGSIZE;
+#endif
+  return (uint8_t *) (t + 1);
+}
+
 /* Returns true if T appears to point to a valid thread. */
 static bool
 is_thread (struct thread *t)
@@ -460,8 +889,10 @@ init_thread (struct thread *t, const char *name, int priority)
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
-  t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->stack = thread_stack_top (t);
+  t->priority = t->base_priority = priority;
+  t->state_ns = timer_now_ns ();
+  list_init (&t->locks);
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -482,18 +913,206 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Returns a page for a new thread, or a null pointer if memory
+   is not available.  The page is not zeroed: init_thread()
+   initializes the struct thread at its base, and the frames that
+   thread_create() pushes on its stack are all that the new
+   thread reads before writing. */
+static struct thread *
+thread_page_alloc (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+#ifdef STACK_GUARD
+  size_t slot;
+  size_t i;
+#endif
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt > 0)
+    t = thread_cache[--thread_cache_cnt];
+  intr_set_level (old_level);
+  if (t != NULL)
+    return t;
+
+#ifdef STACK_GUARD
+  /* Map fresh pages into a free slot, except for its guard
+     page. */
+  old_level = intr_disable ();
+  slot = bitmap_scan_and_flip (stack_slots, 0, 1, false);
+  intr_set_level (old_level);
+  if (slot == BITMAP_ERROR)
+    return NULL;
+
+  t = (struct thread *) (STACK_SLOTS_BASE + slot * THREAD_SLOT_SIZE);
+  for (i = 0; i < THREAD_SLOT_PAGES; i++)
+    if (i != STACK_GUARD_PAGE)
+      {
+        void *page = palloc_get_page (0);
+        if (page == NULL)
+          {
+            old_level = intr_disable ();
+            stack_slot_free (t);
+            intr_set_level (old_level);
+            return NULL;
+          }
+        stack_slots_pt[pt_no (t) + i] = pte_create_kernel (page, true);
+      }
+  return t;
+#else
+  return palloc_get_page (0);
+#endif
+}
+
+/* Releases T's page, which must not be in use, to the cache of
+   thread pages, or to the page allocator if the cache is full.
+   Interrupts must be off. */
+static void
+thread_page_free (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->magic = 0;
+  if (thread_cache_cnt < THREAD_CACHE_MAX)
+    thread_cache[thread_cache_cnt++] = t;
+  else
+#ifdef STACK_GUARD
+    stack_slot_free (t);
+#else
+    palloc_free_page (t);
+#endif
+}
+
+#ifdef STACK_GUARD
+/* Creates the page table that maps the thread slots and installs
+   it in the kernel page directory.  Must be called before any
+   thread is created and before any user page directory is
+   created, since those copy the kernel page directory. */
+static void
+stack_slots_init (void)
+{
+  ASSERT ((uintptr_t) STACK_SLOTS_BASE % THREAD_SLOT_SIZE == 0);
+  ASSERT (pt_no (STACK_SLOTS_BASE) == 0);
+  ASSERT (init_page_dir[pd_no (STACK_SLOTS_BASE)] == 0);
+
+  stack_slots_pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  init_page_dir[pd_no (STACK_SLOTS_BASE)] = pde_create (stack_slots_pt);
+  stack_slots = bitmap_create (STACK_SLOT_CNT);
+  if (stack_slots == NULL)
+    PANIC ("stack_slots_init: out of memory");
+}
+
+/* Unmaps and frees the pages in T's slot and marks the slot
+   free.  Interrupts must be off. */
+static void
+stack_slot_free (struct thread *t)
+{
+  size_t slot = ((uint8_t *) t - STACK_SLOTS_BASE) / THREAD_SLOT_SIZE;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < THREAD_SLOT_PAGES; i++)
+    {
+      uint32_t *pte = &stack_slots_pt[pt_no (t) + i];
+      if (*pte & PTE_P)
+        {
+          palloc_free_page (pte_get_page (*pte));
+          *pte = 0;
+          asm volatile ("invlpg (%0)" : : "r" ((uint8_t *) t + i * PGSIZE)
+                        : "memory");
+        }
+    }
+  bitmap_reset (stack_slots, slot);
+}
+
+/* If ADDR is in the guard page of a thread's stack slot, returns
+   the thread; otherwise, returns a null pointer.  The thread's
+   stack has overflowed if it faulted on ADDR. */
+struct thread *
+thread_stack_guard_owner (const void *addr_)
+{
+  const uint8_t *addr = addr_;
+  size_t slot;
+
+  if (addr < STACK_SLOTS_BASE || addr >= STACK_SLOTS_END)
+    return NULL;
+  slot = (addr - STACK_SLOTS_BASE) / THREAD_SLOT_SIZE;
+  if (pg_no (addr) % THREAD_SLOT_PAGES != STACK_GUARD_PAGE
+      || !bitmap_test (stack_slots, slot))
+    return NULL;
+  return (struct thread *) (STACK_SLOTS_BASE + slot * THREAD_SLOT_SIZE);
+}
+#endif
+
+/* Adds T to the tail of the run queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  int pri = t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= pri && pri <= PRI_MAX);
+
+  list_push_back (&ready_queues[pri - PRI_MIN], &t->elem);
+  ready_mask |= (uint64_t) 1 << (pri - PRI_MIN);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue. */
+static void
+ready_remove (struct thread *t)
+{
+  int pri = t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[pri - PRI_MIN]))
+    ready_mask &= ~((uint64_t) 1 << (pri - PRI_MIN));
+  ready_cnt--;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_max_priority (void)
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  /* __builtin_clz() compiles to a single BSR instruction.  Its
+     result is undefined for a zero argument, so check first. */
+  if (hi != 0)
+    return PRI_MIN + 63 - __builtin_clz (hi);
+  else if (lo != 0)
+    return PRI_MIN + 31 - __builtin_clz (lo);
+  else
+    return PRI_MIN - 1;
+}
+
+/* Chooses and returns the next thread to be scheduled.  Returns
+   the thread at the front of the highest-priority nonempty run
+   queue, unless all the run queues are empty.  (If the running
+   thread can continue running, then it will be in a run queue.)
+   If all the run queues are empty, returns idle_thread. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  int pri = ready_max_priority ();
+  struct list *queue;
+  struct thread *t;
+
+  if (pri < PRI_MIN)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  queue = &ready_queues[pri - PRI_MIN];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << (pri - PRI_MIN));
+  ready_cnt--;
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -521,10 +1140,24 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  if (prev != NULL)
+    {
+      uint64_t now = timer_now_ns ();
+      cur->ready_ns += now - cur->state_ns;
+      cur->state_ns = now;
+      cur->dispatches++;
+    }
 
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Account for the time taken to switch threads. */
+  if (prev != NULL)
+    {
+      switch_cnt++;
+      switch_ns += timer_now_ns () - switch_start;
+    }
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
@@ -538,7 +1171,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_free (prev);
     }
 }
 
@@ -553,15 +1186,35 @@ static void
 schedule (void)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next;
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+
+  /* If the idle thread let the timer skip ticks, catch up before
+     choosing the next thread, since catching up may wake some. */
+  if (cur == idle_thread)
+    idle_ticks += timer_idle_exit ();
+
+  next = next_thread_to_run ();
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      /* A thread that is still ready was preempted; one that
+         blocked gave up the CPU voluntarily. */
+      if (cur->status == THREAD_READY)
+        cur->invol_switches++;
+      else if (cur->status == THREAD_BLOCKED)
+        cur->vol_switches++;
+      trace_record (TRACE_SWITCH, cur, next,
+                    cur->status == THREAD_READY ? TRACE_SWITCH_YIELD
+                    : cur->status == THREAD_BLOCKED ? TRACE_SWITCH_BLOCK
+                    : TRACE_SWITCH_EXIT);
+      switch_start = cur->state_ns = timer_now_ns ();
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +25,17 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+#ifdef STACK_GUARD
+/* Layout of a thread's slot of kernel virtual memory. */
+#define THREAD_SLOT_PAGES 4     /* Pages per slot, a power of 2. */
+#define THREAD_STACK_PAGES (THREAD_SLOT_PAGES - 2)
+#endif
+
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Most favorable to the thread. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least favorable to the thread. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -73,13 +85,26 @@ typedef int tid_t;
    an assertion failure in thread_current(), which checks that
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   value, triggering the assertion.
+
+   If the kernel is compiled with STACK_GUARD defined (for
+   example, by adding -DSTACK_GUARD to DEFINES in Make.vars), then
+   instead every thread except the initial thread gets a
+   THREAD_SLOT_PAGES-page slot in a reserved range of kernel
+   virtual memory.  The slot's first page holds `struct thread',
+   the second page is left unmapped as a guard, and the remaining
+   THREAD_STACK_PAGES pages hold a larger kernel stack.  A stack
+   overflow then faults on the guard page as soon as it happens,
+   and the fault is reported as a stack overflow. */
+/* The `elem' member has several purposes.  It can be an element
+   in the run queue (thread.c), an element in a semaphore wait
+   list (synch.c), an element in the list of sleeping threads
+   (devices/timer.c), or an element in an interrupt queue's list
+   of waiting threads (devices/intq.c).  It can be used these
+   ways only because they are mutually exclusive: only a thread
+   in the ready state is on the run queue, whereas only a blocked
+   thread is on one of the wait lists, and a blocked thread waits
+   for only one thing at a time. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -87,12 +112,35 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority, ignoring donations. */
     struct list_elem allelem;           /* List element for all threads list. */
 
+    /* Owned by thread.c, for the multi-level feedback queue scheduler. */
+    int nice;                           /* Niceness. */
+    fixed_t recent_cpu;                 /* Recent CPU time received. */
+    bool recent_cpu_changed;            /* On the list of changed threads? */
+    struct list_elem changedelem;       /* Element in that list. */
+
+    /* Owned by thread.c, for accounting. */
+    long long cpu_ticks;                /* # of timer ticks spent running. */
+    long long vol_switches;             /* # of times it blocked. */
+    long long invol_switches;           /* # of times it was preempted. */
+    long long dispatches;               /* # of times it was scheduled. */
+    uint64_t ready_ns;                  /* Time spent ready but not running. */
+    uint64_t blocked_ns;                /* Time spent blocked. */
+    uint64_t state_ns;                  /* When the thread last changed state. */
+
     /* Shared between thread.c and synch.c. */
+    struct list locks;                  /* Locks held, for donation. */
+    struct lock *wait_lock;             /* Lock being waited for, if any. */
+
+    /* Shared between thread.c, synch.c and devices/timer.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /* Tick to wake up at, if sleeping. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -107,6 +155,11 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, print each thread's accounting statistics when it
+   exits.  Controlled by kernel command-line option
+   "-thread-stats". */
+extern bool thread_stats;
+
 void thread_init (void);
 void thread_start (void);
 
@@ -125,6 +178,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -132,10 +186,17 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
+uint8_t *thread_stack_top (struct thread *);
+uint8_t *thread_stack_bottom (struct thread *);
+#ifdef STACK_GUARD
+struct thread *thread_stack_guard_owner (const void *);
+#endif
+
 #endif /* threads/thread.h */
@@ -0,0 +1,121 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Scheduler event tracing.
+
+   Events are recorded into a fixed-size ring buffer, so that
+   once it fills up the oldest events are overwritten.  Recording
+   an event takes only a timestamp and a 16-byte store with
+   interrupts disabled, so it may be done from the scheduler and
+   from interrupt handlers.
+
+   trace_dump() prints the buffer, oldest event first, as lines
+   of hexadecimal bytes between "TRACE-BEGIN" and "TRACE-END".
+   utils/pintos-trace converts that into a timeline. */
+
+/* Number of pages in the ring buffer. */
+#define TRACE_PAGES 16
+
+/* Number of events that fit in the ring buffer. */
+#define TRACE_EVENT_CNT (TRACE_PAGES * PGSIZE / sizeof (struct trace_event))
+
+/* If true, record scheduler events.
+   Controlled by kernel command-line option "-trace". */
+bool trace_enabled;
+
+static struct trace_event *events;      /* Ring buffer, or NULL. */
+static uint64_t event_cnt;              /* Number of events ever recorded. */
+
+static void print_thread_name (struct thread *, void *aux);
+
+/* Allocates the ring buffer, if tracing is enabled.  Events
+   that occur before this function is called are not recorded. */
+void
+trace_init (void)
+{
+  if (!trace_enabled)
+    return;
+
+  events = palloc_get_multiple (0, TRACE_PAGES);
+  if (events == NULL)
+    printf ("trace: out of memory, scheduler tracing disabled\n");
+}
+
+/* Records an event of the given TYPE about thread T, involving
+   thread OTHER (which may be null), with type-specific ARG. */
+void
+trace_record (enum trace_type type, const struct thread *t,
+              const struct thread *other, int arg)
+{
+  enum intr_level old_level;
+  struct trace_event *e;
+
+  if (events == NULL)
+    return;
+
+  old_level = intr_disable ();
+  e = &events[event_cnt++ % TRACE_EVENT_CNT];
+  e->time = timer_now_ns ();
+  e->tid = t->tid;
+  e->other = other != NULL ? other->tid : 0;
+  e->type = type;
+  e->arg = arg;
+  e->priority = t->priority;
+  e->reserved = 0;
+  intr_set_level (old_level);
+}
+
+/* Prints the recorded events to the console, followed by the
+   names of the threads that are still alive, and empties the
+   ring buffer. */
+void
+trace_dump (void)
+{
+  enum intr_level old_level;
+  struct trace_event *buf;
+  uint64_t cnt, first, i;
+
+  /* Stop recording while we print, so that printing does not
+     overwrite the events being printed. */
+  old_level = intr_disable ();
+  buf = events;
+  cnt = event_cnt;
+  events = NULL;
+  intr_set_level (old_level);
+  if (buf == NULL)
+    return;
+
+  first = cnt > TRACE_EVENT_CNT ? cnt - TRACE_EVENT_CNT : 0;
+  printf ("TRACE-BEGIN %llu events, %llu dropped\n", cnt - first, first);
+  for (i = first; i < cnt; i++)
+    {
+      const uint8_t *p = (const uint8_t *) &buf[i % TRACE_EVENT_CNT];
+      size_t j;
+
+      printf ("TRACE ");
+      for (j = 0; j < sizeof *buf; j++)
+        printf ("%02x", p[j]);
+      printf ("\n");
+    }
+
+  old_level = intr_disable ();
+  thread_foreach (print_thread_name, NULL);
+  printf ("TRACE-END\n");
+  event_cnt = 0;
+  events = buf;
+  intr_set_level (old_level);
+}
+
+/* Prints the tid and name of thread T for trace_dump(). */
+static void
+print_thread_name (struct thread *t, void *aux UNUSED)
+{
+  printf ("TRACE-THREAD %d %s\n", t->tid, t->name);
+}
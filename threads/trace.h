@@ -0,0 +1,57 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Scheduler trace event types. */
+enum trace_type
+  {
+    TRACE_SWITCH,               /* Context switch from TID to OTHER. */
+    TRACE_BLOCK,                /* TID blocked. */
+    TRACE_UNBLOCK,              /* TID unblocked by OTHER (0 if by IRQ). */
+    TRACE_LOCK,                 /* TID waits for a lock held by OTHER. */
+    TRACE_PREEMPT               /* TID is asked to yield the CPU. */
+  };
+
+/* Reasons for a TRACE_SWITCH, stored in its `arg'. */
+enum trace_switch_reason
+  {
+    TRACE_SWITCH_YIELD,         /* TID is still ready. */
+    TRACE_SWITCH_BLOCK,         /* TID blocked. */
+    TRACE_SWITCH_EXIT           /* TID is dying. */
+  };
+
+/* Reasons for a TRACE_PREEMPT, stored in its `arg'. */
+enum trace_preempt_reason
+  {
+    TRACE_PREEMPT_SLICE,        /* TID used up its time slice. */
+    TRACE_PREEMPT_PRIORITY      /* A higher-priority thread is ready. */
+  };
+
+/* One recorded event.  This is also the binary format that
+   trace_dump() prints and utils/pintos-trace decodes, so its
+   layout must not change without updating that script. */
+struct trace_event
+  {
+    uint64_t time;              /* Nanoseconds since boot. */
+    uint16_t tid;               /* Thread the event is about. */
+    uint16_t other;             /* Other thread involved, or 0. */
+    uint8_t type;               /* A trace_type. */
+    uint8_t arg;                /* Type-specific argument. */
+    uint8_t priority;           /* Priority of TID at the time. */
+    uint8_t reserved;           /* Always 0. */
+  };
+
+/* If true, record scheduler events.
+   Controlled by kernel command-line option "-trace". */
+extern bool trace_enabled;
+
+void trace_init (void);
+void trace_record (enum trace_type, const struct thread *,
+                   const struct thread *other, int arg);
+void trace_dump (void);
+
+#endif /* threads/trace.h */
@@ -0,0 +1,137 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Work queues.
+
+   An interrupt handler should do as little as possible, because
+   interrupts stay off while it runs.  Instead, it can queue a
+   work item with work_queue(), and one of WORKER_CNT kernel
+   threads will run the item's function soon after, with
+   interrupts on and able to sleep, take locks, and so on.
+
+   Work items run in the order they were queued.  Workers run at
+   PRI_MAX so that deferred work is not starved by the threads
+   that interrupted it.  Items queued while more than one worker
+   is idle may run concurrently, so a work function must do its
+   own locking if it shares data with another work item. */
+
+/* Number of worker threads. */
+#define WORKER_CNT 2
+
+/* Queue of pending work items.
+   Protected by disabling interrupts, since work_queue() may be
+   called by interrupt handlers. */
+static struct list work_list;
+
+/* Counts the items in work_list.  Workers wait on it. */
+static struct semaphore work_sema;
+
+/* Statistics. */
+static long long queued_cnt;    /* # of items queued. */
+static long long merged_cnt;    /* # of work_queue() calls on pending items. */
+
+static thread_func worker;
+
+/* Initializes the work queue.  Items may be queued from then
+   on, but they do not run until workqueue_start() is called.
+   Must be called before any interrupt handler that queues work
+   is registered. */
+void
+workqueue_init (void)
+{
+  list_init (&work_list);
+  sema_init (&work_sema, 0);
+}
+
+/* Starts the worker threads.  Must be called after
+   thread_start(). */
+void
+workqueue_start (void)
+{
+  int i;
+
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "worker%d", i);
+      if (thread_create (name, PRI_MAX, worker, NULL) == TID_ERROR)
+        PANIC ("workqueue_init: failed to start %s", name);
+    }
+}
+
+/* Initializes W to run FUNC, passing AUX. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Queues W to be run by a worker thread.  May be called from an
+   interrupt handler.
+
+   If W is already queued and has not yet started running, does
+   nothing and returns false: the pending run will observe
+   whatever state caused this call.  Otherwise, returns true.
+   W may be queued again while its function is running, in which
+   case it runs again afterward. */
+bool
+work_queue (struct work *w)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  ASSERT (w != NULL);
+
+  old_level = intr_disable ();
+  queued = !w->pending;
+  if (queued)
+    {
+      w->pending = true;
+      list_push_back (&work_list, &w->elem);
+      queued_cnt++;
+    }
+  else
+    merged_cnt++;
+  intr_set_level (old_level);
+
+  if (queued)
+    sema_up (&work_sema);
+  return queued;
+}
+
+/* Prints work queue statistics. */
+void
+workqueue_print_stats (void)
+{
+  printf ("Work queue: %lld items queued, %lld merged into pending items\n",
+          queued_cnt, merged_cnt);
+}
+
+/* Worker thread.  Runs queued work items, forever. */
+static void
+worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      sema_down (&work_sema);
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&work_list), struct work, elem);
+      w->pending = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+    }
+}
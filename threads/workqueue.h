@@ -0,0 +1,29 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* A function run by a worker thread, given auxiliary data AUX. */
+typedef void work_func (void *aux);
+
+/* A deferred work item.
+
+   The owner of a work item initializes it once with work_init()
+   and then calls work_queue() each time it wants FUNC to run.
+   The item must stay allocated until it has finished running. */
+struct work
+  {
+    struct list_elem elem;      /* Element in the work queue. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* Queued but not yet started? */
+  };
+
+void workqueue_init (void);
+void workqueue_start (void);
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct work *);
+void workqueue_print_stats (void);
+
+#endif /* threads/workqueue.h */
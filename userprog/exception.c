@@ -2,6 +2,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/tss.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
@@ -10,6 +11,9 @@ static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+#ifdef STACK_GUARD
+static void double_fault (void) NO_RETURN;
+#endif
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -58,6 +62,13 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+#ifdef STACK_GUARD
+  /* A kernel stack overflow becomes a double fault, which must
+     be handled on a separate stack, by a task of its own. */
+  tss_init_double_fault (double_fault);
+  intr_register_task (8, SEL_DFTSS, "#DF Double Fault Exception");
+#endif
 }
 
 /* Prints exception statistics. */
@@ -148,6 +159,12 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef STACK_GUARD
+  if (!user && thread_stack_guard_owner (fault_addr) != NULL)
+    PANIC ("kernel stack overflow in thread %s: access to %p at eip %p",
+           thread_stack_guard_owner (fault_addr)->name, fault_addr, f->eip);
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -158,3 +175,24 @@ page_fault (struct intr_frame *f)
           user ? "user" : "kernel");
   kill (f);
 }
+
+#ifdef STACK_GUARD
+/* Double-fault task.  Runs on its own stack, in place of the
+   faulting context, which cannot continue.  If the fault was an
+   overflow onto a kernel stack's guard page, says so. */
+static void
+double_fault (void)
+{
+  struct thread *t;
+  void *fault_addr, *eip, *esp;
+
+  asm ("movl %%cr2, %0" : "=r" (fault_addr));
+  tss_get_faulting_task (&eip, &esp);
+
+  t = thread_stack_guard_owner (fault_addr);
+  if (t != NULL)
+    PANIC ("kernel stack overflow in thread %s: access to %p at eip %p",
+           t->name, fault_addr, eip);
+  PANIC ("double fault at eip %p, esp %p, cr2 %p", eip, esp, fault_addr);
+}
+#endif
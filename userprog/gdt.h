@@ -8,7 +8,8 @@
 #define SEL_UCSEG       0x1B    /* User code selector. */
 #define SEL_UDSEG       0x23    /* User data selector. */
 #define SEL_TSS         0x28    /* Task-state segment. */
-#define SEL_CNT         6       /* Number of segments. */
+#define SEL_DFTSS       0x30    /* Double-fault task-state segment. */
+#define SEL_CNT         7       /* Number of segments. */
 
 void gdt_init (void);
 
@@ -11,6 +11,7 @@
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
 
 typedef int pid_t;
 
@@ -186,6 +187,14 @@ syscall_handler (struct intr_frame *f UNUSED)
 	f->eax = 1;
     	break;
       }
+      case SYS_CLOCK_NS:
+      {
+        /* Store nanoseconds since boot into the user's uint64_t. */
+        uint64_t *ns = (uint64_t *) *(esp + 1);
+        if (isAddressValid (ns) && isAddressValid ((char *) (ns + 1) - 1))
+          *ns = timer_now_ns ();
+        break;
+      }
       default:
           break;
   }
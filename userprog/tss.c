@@ -2,6 +2,8 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/flags.h"
+#include "threads/init.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -75,6 +77,19 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+#ifdef STACK_GUARD
+/* Task-state segment for the double-fault task.
+
+   A kernel stack overflow faults on the stack's guard page, and
+   the processor cannot push the page fault's interrupt frame on
+   the same stack, so it raises a double fault instead.  To
+   handle that, the double fault must switch to a fresh stack,
+   which requires a task gate and a second TSS.  When the task
+   switch occurs, the processor saves the faulting context's
+   registers in `tss', where the handler can inspect them. */
+static struct tss *df_tss;
+#endif
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void)
@@ -86,6 +101,11 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+
+#ifdef STACK_GUARD
+  df_tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  df_tss->bitmap = 0xdfff;
+#endif
 }
 
 /* Returns the kernel TSS. */
@@ -102,5 +122,42 @@ void
 tss_update (void)
 {
   ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss->esp0 = thread_stack_top (thread_current ());
+}
+
+#ifdef STACK_GUARD
+/* Returns the double-fault task's TSS. */
+struct tss *
+tss_get_double_fault (void)
+{
+  ASSERT (df_tss != NULL);
+  return df_tss;
+}
+
+/* Sets up the double-fault task to run HANDLER, which must not
+   return, in the kernel address space on a stack of its own. */
+void
+tss_init_double_fault (void (*handler) (void))
+{
+  uint8_t *stack = palloc_get_page (PAL_ASSERT);
+
+  ASSERT (df_tss != NULL);
+  df_tss->cr3 = vtop (init_page_dir);
+  df_tss->eip = handler;
+  df_tss->eflags = FLAG_MBS;
+  df_tss->esp = (uint32_t) (stack + PGSIZE);
+  df_tss->cs = SEL_KCSEG;
+  df_tss->ss = df_tss->ds = df_tss->es = SEL_KDSEG;
+  df_tss->fs = df_tss->gs = SEL_KDSEG;
+}
+
+/* Within the double-fault task, stores the instruction and stack
+   pointers of the context that faulted into *EIP and *ESP. */
+void
+tss_get_faulting_task (void **eip, void **esp)
+{
+  ASSERT (tss != NULL);
+  *eip = (void *) tss->eip;
+  *esp = (void *) tss->esp;
 }
+#endif
@@ -7,5 +7,10 @@ struct tss;
 void tss_init (void);
 struct tss *tss_get (void);
 void tss_update (void);
+#ifdef STACK_GUARD
+struct tss *tss_get_double_fault (void);
+void tss_init_double_fault (void (*handler) (void));
+void tss_get_faulting_task (void **eip, void **esp);
+#endif
 
 #endif /* userprog/tss.h */